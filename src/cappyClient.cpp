@@ -0,0 +1,158 @@
+#include "cappyClient.h"
+
+#include <algorithm>
+
+#if !_WIN32
+  #include <cstdlib>
+  #include <cstring>
+  #include <sys/socket.h>
+  #include <sys/stat.h>
+  #include <sys/time.h>
+  #include <sys/un.h>
+  #include <unistd.h>
+#endif
+
+#ifndef MSG_NOSIGNAL
+  #define MSG_NOSIGNAL 0
+#endif
+
+#if !_WIN32
+static bool write_all(int fd, const void* data, size_t size) {
+  const uint8_t* p = (const uint8_t*)data;
+  while (size > 0) {
+    ssize_t written = send(fd, p, size, MSG_NOSIGNAL);
+    if (written <= 0) return false;
+    p += written;
+    size -= written;
+  }
+  return true;
+}
+
+static bool read_all(int fd, void* data, size_t size) {
+  uint8_t* p = (uint8_t*)data;
+  while (size > 0) {
+    ssize_t got = read(fd, p, size);
+    if (got <= 0) return false;
+    p += got;
+    size -= got;
+  }
+  return true;
+}
+#endif
+
+std::string cappy_socket_path() {
+#if _WIN32
+  return {};
+#else
+  const char* runtime_dir = getenv("XDG_RUNTIME_DIR");
+  if (runtime_dir && *runtime_dir) return std::string(runtime_dir) + "/cappy.sock";
+  return "/tmp/cappy-" + std::to_string(getuid()) + "/cappy.sock";
+#endif
+}
+
+bool cappy_socket_dir_private(const std::string& path, bool create) {
+#if _WIN32
+  return false;
+#else
+  size_t slash    = path.rfind('/');
+  std::string dir = slash == std::string::npos ? "." : path.substr(0, std::max<size_t>(slash, 1));
+  if (create) mkdir(dir.c_str(), 0700);
+
+  // lstat, a symlink to someone else's directory doesn't count
+  struct stat info;
+  return lstat(dir.c_str(), &info) == 0 && S_ISDIR(info.st_mode) && info.st_uid == getuid() && (info.st_mode & 077) == 0;
+#endif
+}
+
+CappyClient::~CappyClient() {
+  close();
+}
+
+bool CappyClient::connect(const std::string& path, int timeout_ms) {
+  close();
+
+#if _WIN32
+  return false;
+#else
+  sockaddr_un address;
+  std::memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address.sun_path) || !cappy_socket_dir_private(path, false)) return false;
+  std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) return false;
+
+  // connect waits as long as sends when the daemon's backlog is full
+  timeval timeout = {timeout_ms / 1000, timeout_ms % 1000 * 1000};
+  if (setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) < 0 ||
+      setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0 ||
+      ::connect(fd, (sockaddr*)&address, sizeof(address)) < 0) {
+    close();
+    return false;
+  }
+  return true;
+#endif
+}
+
+void CappyClient::close() {
+#if !_WIN32
+  if (fd >= 0) ::close(fd);
+#endif
+  fd = -1;
+}
+
+bool CappyClient::request(uint32_t op, const void* payload, uint32_t size, void* reply, uint64_t reply_size) {
+#if _WIN32
+  return false;
+#else
+  if (fd < 0) return false;
+
+  CappyRequest header = {op, size};
+  CappyReply answer;
+  if (!write_all(fd, &header, sizeof(header)) || !write_all(fd, payload, size) || !read_all(fd, &answer, sizeof(answer))) {
+    close();
+    return false;
+  }
+
+  status = answer.status;
+  if (status != CAPPY_OK) return false;
+
+  // anything else means both sides disagree about the protocol
+  if (answer.size != reply_size || !read_all(fd, reply, reply_size)) {
+    close();
+    return false;
+  }
+  return true;
+#endif
+}
+
+bool CappyClient::show() {
+  return request(CAPPY_OP_SHOW, nullptr, 0, nullptr, 0);
+}
+
+bool CappyClient::capture(CappyCaptureInfo* info) {
+  CappyCaptureInfo ignored;
+  return request(CAPPY_OP_CAPTURE, nullptr, 0, info ? info : &ignored, sizeof(CappyCaptureInfo));
+}
+
+bool CappyClient::info(CappyCaptureInfo& info) {
+  return request(CAPPY_OP_INFO, nullptr, 0, &info, sizeof(info));
+}
+
+bool CappyClient::pixels(const CappyPoint* points, size_t count, CappyPixel* out) {
+  for (size_t i = 0; i < count; i += cappy_max_points) {
+    size_t n = std::min<size_t>(cappy_max_points, count - i);
+    if (!request(CAPPY_OP_PIXELS, points + i, (uint32_t)(n * sizeof(CappyPoint)), out + i, n * sizeof(CappyPixel))) return false;
+  }
+  return true;
+}
+
+bool CappyClient::region(const CappyRect& rect, uint8_t* rgb) {
+  uint64_t size = (uint64_t)std::max(rect.width, 0) * std::max(rect.height, 0) * 3;
+  return request(CAPPY_OP_REGION, &rect, sizeof(rect), rgb, size);
+}
+
+bool CappyClient::stats(const CappyRect& rect, CappyStats& stats) {
+  return request(CAPPY_OP_STATS, &rect, sizeof(rect), &stats, sizeof(stats));
+}
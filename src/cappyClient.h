@@ -0,0 +1,68 @@
+#ifndef _CAPPY_CLIENT_H_
+#define _CAPPY_CLIENT_H_
+
+#include <cstdint>
+#include <string>
+
+#include "cappyProtocol.h"
+
+// Path of the socket cappy --daemon listens on, in XDG_RUNTIME_DIR when set
+// and otherwise in a directory of its own in /tmp.
+std::string cappy_socket_path();
+
+// Checks that only the user can enter the directory the socket at path is
+// in, so nobody else can connect to it or put a socket of theirs there.
+// create makes the directory first when it is missing.
+bool cappy_socket_dir_private(const std::string& path, bool create);
+
+// Client for the socket API of cappy --daemon, see cappyProtocol.h. Has no
+// dependencies besides the C++ standard library, test harnesses can link
+// the cappy_client library. Every call blocks until the reply arrived and
+// returns false on errors, last_status tells what the daemon replied. A
+// daemon that stops answering for longer than the timeout given to connect
+// counts as an error too, and the connection is closed.
+class CappyClient {
+public:
+  CappyClient() = default;
+  ~CappyClient();
+
+  CappyClient(const CappyClient&)            = delete;
+  CappyClient& operator=(const CappyClient&) = delete;
+
+  // long enough for a capture of several screens
+  static constexpr int default_timeout_ms = 5000;
+
+  bool connect(const std::string& path = cappy_socket_path(), int timeout_ms = default_timeout_ms);
+  void close();
+
+  bool is_connected() const {
+    return fd >= 0;
+  }
+
+  uint32_t last_status() const {
+    return status;
+  }
+
+  // Lets the daemon capture and show its window, like running cappy.
+  bool show();
+
+  // Captures again without showing the window. info may be nullptr.
+  bool capture(CappyCaptureInfo* info);
+  bool info(CappyCaptureInfo& info);
+
+  // Looks up any number of points, in batches of cappy_max_points.
+  bool pixels(const CappyPoint* points, size_t count, CappyPixel* out);
+
+  // Copies rect as rect.width * rect.height RGB triples into rgb.
+  bool region(const CappyRect& rect, uint8_t* rgb);
+
+  bool stats(const CappyRect& rect, CappyStats& stats);
+
+private:
+  bool request(uint32_t op, const void* payload, uint32_t size, void* reply, uint64_t reply_size);
+
+  int fd          = -1;
+  uint32_t status = CAPPY_OK;
+};
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef _CAPPY_PROTOCOL_H_
+#define _CAPPY_PROTOCOL_H_
+
+#include <cstdint>
+
+// Binary protocol spoken on the socket of cappy --daemon. Every request is a
+// CappyRequest followed by size payload bytes, every reply a CappyReply
+// followed by size payload bytes. Values are in host byte order, the socket
+// is local. A connection can carry any number of requests, answered in order.
+//
+// Pixels are read from the latest capture, which only changes on a capture
+// request, F5, live mode or the timeline. Replies larger than a few hundred
+// KB are read in chunks, so a live capture can change in between.
+
+enum CappyOp : uint32_t {
+  CAPPY_OP_SHOW    = 1, // capture and show the window, no payload or reply
+  CAPPY_OP_CAPTURE = 2, // capture without showing, replies CappyCaptureInfo
+  CAPPY_OP_INFO    = 3, // replies CappyCaptureInfo of the latest capture
+  CAPPY_OP_PIXELS  = 4, // payload n CappyPoint, replies n CappyPixel
+  CAPPY_OP_REGION  = 5, // payload CappyRect, replies width * height RGB triples
+  CAPPY_OP_STATS   = 6, // payload CappyRect, replies CappyStats
+};
+
+enum CappyStatus : uint32_t {
+  CAPPY_OK          = 0,
+  CAPPY_BAD_REQUEST = 1, // unknown op or malformed payload
+  CAPPY_FAILED      = 2, // the capture failed
+  CAPPY_NO_CAPTURE  = 3, // nothing was captured yet
+};
+
+struct CappyRequest {
+  uint32_t op;   // CappyOp
+  uint32_t size; // payload bytes
+};
+
+struct CappyReply {
+  uint32_t status; // CappyStatus, there is no payload unless CAPPY_OK
+  uint32_t size;   // payload bytes
+};
+
+struct CappyPoint {
+  int32_t x;
+  int32_t y;
+};
+
+// covered is 255 when a capture region contains the point. Points in the gaps
+// between monitors or outside of the capture are all 0.
+struct CappyPixel {
+  uint8_t r;
+  uint8_t g;
+  uint8_t b;
+  uint8_t covered;
+};
+
+// CAPPY_OP_PIXELS takes at most this many points. The daemon reads all of
+// them before it answers, so a client can send them in one go.
+static constexpr uint32_t cappy_max_points = 65536;
+
+// the largest payload a request may have
+static constexpr uint32_t cappy_max_request_size = cappy_max_points * sizeof(CappyPoint);
+
+struct CappyRect {
+  int32_t x;
+  int32_t y;
+  int32_t width;
+  int32_t height;
+};
+
+struct CappyCaptureInfo {
+  int32_t width; // bounding box of all regions
+  int32_t height;
+  uint32_t region_count;
+  uint32_t reserved;
+};
+
+// Statistics over the covered pixels of a rectangle, per channel r, g, b.
+struct CappyStats {
+  uint64_t pixels;
+  uint8_t min[3];
+  uint8_t max[3];
+  uint8_t reserved[2];
+  double mean[3];
+  double stddev[3];
+};
+
+#endif
@@ -1,27 +1,228 @@
 #include "capture.h"
+#include "convert.h"
+#include "scrollStitch.h"
 
+#include <algorithm>
 #include <bitset>
+#include <cctype>
+#include <chrono>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
 #include <iomanip>
 #include <sstream>
+#include <thread>
 
 #include "stb_image.h"
 
 #if __linux__
-  #include <X11/Xlib.h>
-  #include <X11/Xutil.h>
+  #include "x11Grab.h"
+  #include <X11/extensions/Xcomposite.h>
 #elif _WIN32
   #include <windows.h>
 #endif
 
 Capture::~Capture() {
-  if (captured) delete pixels;
+  release();
 }
 
-bool Capture::capture() {
-  if (captured) return false;
+RGB* Capture::reserve(size_t count) {
+  if (count > capacity) {
+    release();
+    pixels   = new RGB[count];
+    capacity = count;
+  }
+  return pixels;
+}
+
+// Like reserve, for the raw pixels. A buffer from an earlier raw capture is
+// reused when the new one fits.
+uint8_t* Capture::reserve_raw(size_t bytes) {
+  uint8_t* buffer        = raw_owned;
+  size_t buffer_capacity = raw_capacity;
+  raw_owned              = nullptr;
+  raw_capacity           = 0;
+  release();
+
+  if (buffer_capacity < bytes) {
+    delete[] buffer;
+    buffer          = new uint8_t[bytes];
+    buffer_capacity = bytes;
+  }
+  raw_owned    = buffer;
+  raw_capacity = buffer_capacity;
+  raw_data     = buffer;
+  return buffer;
+}
+
+void Capture::release() {
+  if (pixels_shared) {
+    pixels_shared = false;
+  } else if (pixels_mapped) {
+    mapping.close();
+    pixels_mapped = false;
+  } else if (pixels_stbi) {
+    stbi_image_free(pixels);
+    pixels_stbi = false;
+  } else if (pyramid.is_open()) {
+    pyramid.close();
+  } else {
+    delete[] pixels;
+  }
+  pixels   = nullptr;
+  capacity = 0;
+  store.clear();
+
+  delete[] raw_owned;
+  raw_owned    = nullptr;
+  raw_capacity = 0;
+  raw_data     = nullptr;
+  raw_regions.clear();
+  // raw pixels can point into the mapping too
+  mapping.close();
+}
+
+std::mutex& capture_error_handler_lock() {
+  static std::mutex lock;
+  return lock;
+}
+
+const char* capture_backend_name(CaptureBackend backend) {
+  switch (backend) {
+    case CaptureBackend::Unknown: return "unknown";
+    case CaptureBackend::XShm: return "XShmGetImage";
+    case CaptureBackend::XGetImage: return "XGetImage";
+    case CaptureBackend::XComposite: return "XComposite";
+    case CaptureBackend::GDI: return "GDI";
+    case CaptureBackend::File: return "file";
+    case CaptureBackend::Mapped: return "mmap";
+    case CaptureBackend::Shm: return "shared memory";
+    case CaptureBackend::Stitched: return "scroll stitching";
+    case CaptureBackend::Tiled: return "tile pyramid";
+  }
+  return "unknown";
+}
+
+// Clips regions to the capture area of options. When the area misses every
+// region the regions are left untouched, an empty capture is of no use.
+static void clip_regions(std::vector<CaptureRegion>& regions, const CaptureOptions& options, int width, int height) {
+  int ax1 = std::max(options.area_x, 0);
+  int ay1 = std::max(options.area_y, 0);
+  int ax2 = options.area_w > 0 ? std::min(options.area_x + options.area_w, width) : width;
+  int ay2 = options.area_h > 0 ? std::min(options.area_y + options.area_h, height) : height;
+
+  std::vector<CaptureRegion> clipped;
+  for (const CaptureRegion& region : regions) {
+    int x1 = std::max(ax1, region.x);
+    int y1 = std::max(ay1, region.y);
+    int x2 = std::min(ax2, region.x + region.width);
+    int y2 = std::min(ay2, region.y + region.height);
+    if (x2 > x1 && y2 > y1) {
+      clipped.push_back({x1, y1, x2 - x1, y2 - y1, 0});
+    }
+  }
+
+  if (!clipped.empty()) regions = std::move(clipped);
+}
 
 #if __linux__
+// Grabs one region on a display connection of its own, so it can run on a
+// thread next to the grabs of the other regions.
+static bool grab_region_on_own_display(const CaptureRegion& region, RGB* pixels, uint8_t* raw, RGB* low_bits, int threads, bool& used_shm) {
   Display* display = XOpenDisplay(NULL);
+  if (!display) return false;
+
+  Window root = DefaultRootWindow(display);
+
+  XWindowAttributes attr;
+  if (!XGetWindowAttributes(display, root, &attr)) {
+    XCloseDisplay(display);
+    return false;
+  }
+
+  XShmSegmentInfo shminfo;
+  used_shm = xshm_attach(display, attr, {region}, shminfo);
+
+  bool ok;
+  if (raw) {
+    ok = grab_rect_bgrx(display, root, attr, used_shm ? &shminfo : nullptr, region.x, region.y, region.width, region.height, raw + region.offset * 4, (size_t)region.width * 4);
+  } else {
+    RGB* low = low_bits ? low_bits + region.offset : nullptr;
+    ok       = grab_rect(display, root, attr, used_shm ? &shminfo : nullptr, region.x, region.y, region.width, region.height, pixels + region.offset, region.width, threads, low);
+  }
+
+  if (used_shm) xshm_detach(display, shminfo);
+  XCloseDisplay(display);
+
+  return ok;
+}
+
+// The display connection and shared memory segment of screen and window
+// grabs, kept between grabs so a recapture neither connects again nor
+// creates and attaches a segment the size of the screen. The segment is only
+// replaced when a grab needs more than it holds. Only touched while holding
+// capture_error_handler_lock.
+struct GrabConnection {
+  Display* display = nullptr;
+  XShmSegmentInfo shminfo;
+  size_t shm_size = 0;
+  bool shm_failed = false; // e.g. a remote display, grabs use XGetImage
+
+  ~GrabConnection() {
+    if (shm_size) xshm_detach(display, shminfo);
+    if (display) XCloseDisplay(display);
+  }
+
+  Display* open() {
+    if (!display) display = XOpenDisplay(NULL);
+    return display;
+  }
+
+  // A segment for the largest of regions, null when XShm can't be used.
+  XShmSegmentInfo* segment(const XWindowAttributes& attr, const std::vector<CaptureRegion>& regions) {
+    if (shm_failed) return nullptr;
+
+    size_t size = xshm_size(display, attr, regions);
+    if (size == 0) return nullptr;
+    if (size > shm_size) {
+      if (shm_size) xshm_detach(display, shminfo);
+      shm_size = 0;
+      if (!xshm_attach(display, size, shminfo)) {
+        shm_failed = true;
+        return nullptr;
+      }
+      shm_size = size;
+    }
+    return &shminfo;
+  }
+};
+
+static GrabConnection grab_connection;
+#endif
+
+bool Capture::capture(const CaptureOptions& options) {
+  captured = false;
+  window   = 0;
+  depth    = 8;
+  low_bits.clear();
+
+  if (!options.shm_name.empty()) return capture_shm(options);
+
+  if (shm.is_attached()) {
+    release();
+    shm.detach();
+  }
+
+  if (options.scroll) return capture_scroll(options);
+
+  if (!options.file.empty()) return capture_file(options);
+
+#if __linux__
+  if (options.window) return capture_window(options);
+
+  std::lock_guard<std::mutex> handler_lock(capture_error_handler_lock());
+  Display* display = grab_connection.open();
   if (!display) {
     return false;
   }
@@ -30,34 +231,84 @@ bool Capture::capture() {
 
   XWindowAttributes attr;
   if (!XGetWindowAttributes(display, root, &attr)) {
-    XCloseDisplay(display);
     return false;
   }
 
-  XImage* image = XGetImage(display, root, 0, 0, attr.width, attr.height, AllPlanes, ZPixmap);
-  if (!image) {
-    XCloseDisplay(display);
-    return false;
+  width   = attr.width;
+  height  = attr.height;
+  regions = xrandr_regions(display, root, attr);
+  clip_regions(regions, options, width, height);
+
+  size_t total = 0;
+  for (CaptureRegion& region : regions) {
+    region.offset = total;
+    total += (size_t)region.width * region.height;
+  }
+
+  // The usual BGRX rows are kept as they are, the textures take them as they
+  // are and RGB is only made where something looks. Anything else, e.g.
+  // depth 30 visuals with the bits below the upper 8 in low_bits, is
+  // converted right away.
+  uint8_t* raw = nullptr;
+  if (x11_is_bgrx(display, attr)) {
+    raw        = reserve_raw(total * 4);
+    raw_format = PixelFormat::BGRX32;
+    for (const CaptureRegion& region : regions) {
+      raw_regions.push_back({(ptrdiff_t)region.offset * 4, (ptrdiff_t)region.width * 4});
+    }
+  } else {
+    reserve(total);
+  }
+
+  int channel_bits = x11_channel_bits(attr.visual);
+  if (channel_bits > 8) {
+    depth = channel_bits;
+    low_bits.resize(total);
   }
+  RGB* low = low_bits.empty() ? nullptr : low_bits.data();
 
-  width  = attr.width;
-  stride = attr.width;
-  height = attr.height;
-  pixels = new RGB[width * height];
+  XErrorHandler old_handler = XSetErrorHandler(x11_error_handler);
 
-  for (int x = 0; x < width; x++) {
-    for (int y = 0; y < height; y++) {
-      int index       = y * width + x;
-      unsigned long p = XGetPixel(image, x, y);
+  bool ok = true;
+  if (options.parallel && regions.size() > 1) {
+    int cores   = std::max(1u, std::thread::hardware_concurrency());
+    int threads = std::max<int>(1, cores / regions.size());
 
-      pixels[index].r = (p >> 16) & 0xFF;
-      pixels[index].g = (p >> 8) & 0xFF;
-      pixels[index].b = (p >> 0) & 0xFF;
+    std::vector<std::thread> workers;
+    std::vector<char> results(regions.size(), false);
+    std::vector<char> used_shm(regions.size(), false);
+    for (size_t i = 0; i < regions.size(); i++) {
+      workers.emplace_back([&, i] {
+        bool shm    = false;
+        results[i]  = grab_region_on_own_display(regions[i], pixels, raw, low, threads, shm);
+        used_shm[i] = shm;
+      });
+    }
+    for (std::thread& worker : workers) {
+      worker.join();
+    }
+
+    ok      = std::all_of(results.begin(), results.end(), [](char r) { return r; });
+    backend = std::all_of(used_shm.begin(), used_shm.end(), [](char r) { return r; }) ? CaptureBackend::XShm : CaptureBackend::XGetImage;
+  } else {
+    XShmSegmentInfo* segment = grab_connection.segment(attr, regions);
+    backend                  = segment ? CaptureBackend::XShm : CaptureBackend::XGetImage;
+
+    for (const CaptureRegion& region : regions) {
+      if (raw ? !grab_rect_bgrx(display, root, attr, segment, region.x, region.y, region.width, region.height, raw + region.offset * 4, (size_t)region.width * 4)
+              : !grab_rect(display, root, attr, segment, region.x, region.y, region.width, region.height, pixels + region.offset, region.width, 0, low ? low + region.offset : nullptr)) {
+        ok = false;
+        break;
+      }
     }
   }
 
-  XDestroyImage(image);
-  XCloseDisplay(display);
+  XSetErrorHandler(old_handler);
+
+  if (!ok) {
+    regions.clear();
+    return false;
+  }
 
   captured = true;
   return true;
@@ -65,13 +316,19 @@ bool Capture::capture() {
   SetProcessDPIAware();
   HDC hScreenDC = GetDC(nullptr);
   HDC hMemoryDC = CreateCompatibleDC(hScreenDC);
-  
-  width              = GetSystemMetrics(SM_CXVIRTUALSCREEN);
-  height             = GetSystemMetrics(SM_CYVIRTUALSCREEN);
-  stride             = width;
-  HBITMAP hBitmap    = CreateCompatibleBitmap(hScreenDC, width, height);
+
+  width   = GetSystemMetrics(SM_CXVIRTUALSCREEN);
+  height  = GetSystemMetrics(SM_CYVIRTUALSCREEN);
+  regions = {{0, 0, width, height, 0}};
+  clip_regions(regions, options, width, height);
+
+  const CaptureRegion& region = regions[0];
+  int region_x                = GetSystemMetrics(SM_XVIRTUALSCREEN) + region.x;
+  int region_y                = GetSystemMetrics(SM_YVIRTUALSCREEN) + region.y;
+
+  HBITMAP hBitmap    = CreateCompatibleBitmap(hScreenDC, region.width, region.height);
   HBITMAP hOldBitmap = static_cast<HBITMAP>(SelectObject(hMemoryDC, hBitmap));
-  BitBlt(hMemoryDC, GetSystemMetrics(SM_XVIRTUALSCREEN), GetSystemMetrics(SM_YVIRTUALSCREEN), width, height, hScreenDC, 0, 0, SRCCOPY);
+  BitBlt(hMemoryDC, 0, 0, region.width, region.height, hScreenDC, region_x, region_y, SRCCOPY);
   hBitmap = static_cast<HBITMAP>(SelectObject(hMemoryDC, hOldBitmap));
 
   BITMAPINFO MyBMInfo       = {0};
@@ -83,7 +340,8 @@ bool Capture::capture() {
     return false;
   }
 
-  BYTE* pixel_bytes = new BYTE[MyBMInfo.bmiHeader.biSizeImage];
+  size_t pixel_bytes_size = MyBMInfo.bmiHeader.biSizeImage;
+  BYTE* pixel_bytes      = new BYTE[pixel_bytes_size];
 
   MyBMInfo.bmiHeader.biBitCount    = 32;
   MyBMInfo.bmiHeader.biCompression = BI_RGB;
@@ -96,24 +354,19 @@ bool Capture::capture() {
     return false;
   }
 
-  pixels = new RGB[width * height];
-
-  int i = 0;
-
-  for (int y = height - 1; y >= 0; --y) {
-    for (int x = 0; x < width; ++x) {
-      RGB& rgb = pixels[i];
-      rgb.b    = pixel_bytes[(y * width + x) * 4];
-      rgb.g    = pixel_bytes[(y * width + x) * 4 + 1];
-      rgb.r    = pixel_bytes[(y * width + x) * 4 + 2];
-      i++;
-    }
-  }
+  // the BGRX rows are kept as the raw pixels. DIBs are stored bottom-up, so
+  // the rows are walked backwards.
+  release();
+  raw_owned    = pixel_bytes;
+  raw_capacity = pixel_bytes_size;
+  raw_data     = pixel_bytes;
+  raw_format   = PixelFormat::BGRX32;
+  raw_regions  = {{(ptrdiff_t)(region.height - 1) * region.width * 4, -(ptrdiff_t)region.width * 4}};
 
   DeleteDC(hMemoryDC);
   DeleteDC(hScreenDC);
-  delete[] pixel_bytes;
 
+  backend  = CaptureBackend::GDI;
   captured = true;
   return true;
 #endif
@@ -121,41 +374,736 @@ bool Capture::capture() {
   return false;
 }
 
+unsigned long capture_find_window(const char* name) {
+#if __linux__
+  Display* display = XOpenDisplay(NULL);
+  if (!display) return 0;
+
+  Window found = x11_find_window(display, DefaultRootWindow(display), name);
+
+  XCloseDisplay(display);
+  return found;
+#else
+  return 0;
+#endif
+}
+
+unsigned long capture_pick_window() {
+#if __linux__
+  Display* display = XOpenDisplay(NULL);
+  if (!display) return 0;
+
+  Window picked = x11_pick_window(display, DefaultRootWindow(display));
+
+  XCloseDisplay(display);
+  return picked;
+#else
+  return 0;
+#endif
+}
+
+// Grabs a single window. With XComposite the window is redirected off-screen
+// and read from its backing pixmap, which holds the whole window even where
+// other windows cover it. Without a compositing manager the covered parts are
+// only filled in once the application repaints after the redirect. When the
+// extension is missing the window is read directly and covered parts show
+// whatever covers them.
+bool Capture::capture_window(const CaptureOptions& options) {
+#if __linux__
+  std::lock_guard<std::mutex> handler_lock(capture_error_handler_lock());
+  Display* display = grab_connection.open();
+  if (!display) return false;
+
+  Window target = options.window;
+
+  XErrorHandler old_handler = XSetErrorHandler(x11_error_handler);
+
+  XWindowAttributes attr;
+  if (!XGetWindowAttributes(display, target, &attr) || attr.map_state != IsViewable) {
+    XSetErrorHandler(old_handler);
+    return false;
+  }
+
+  // the area is on the screen, the regions are relative to the window
+  Window child;
+  if (!XTranslateCoordinates(display, target, attr.root, 0, 0, &window_x, &window_y, &child)) {
+    window_x = 0;
+    window_y = 0;
+  }
+  CaptureOptions area = options;
+  area.area_x -= window_x;
+  area.area_y -= window_y;
+
+  width   = attr.width;
+  height  = attr.height;
+  regions = {{0, 0, width, height, 0}};
+  clip_regions(regions, area, width, height);
+
+  const CaptureRegion& region = regions[0];
+  reserve((size_t)region.width * region.height);
+
+  int channel_bits = x11_channel_bits(attr.visual);
+  if (channel_bits > 8) {
+    depth = channel_bits;
+    low_bits.resize((size_t)region.width * region.height);
+  }
+  RGB* low = low_bits.empty() ? nullptr : low_bits.data();
+
+  int event_base, error_base;
+  int major = 0, minor = 2;
+  bool composite = XCompositeQueryExtension(display, &event_base, &error_base) && XCompositeQueryVersion(display, &major, &minor) && (major > 0 || minor >= 2);
+
+  Pixmap pixmap = None;
+  if (composite) {
+    XCompositeRedirectWindow(display, target, CompositeRedirectAutomatic);
+    pixmap = XCompositeNameWindowPixmap(display, target);
+    XSync(display, False);
+  }
+
+  XShmSegmentInfo* segment = grab_connection.segment(attr, regions);
+
+  // the pixmap includes the window border, the window itself does not
+  bool ok = false;
+  if (pixmap != None) {
+    int border = attr.border_width;
+    ok         = grab_rect(display, pixmap, attr, segment, region.x + border, region.y + border, region.width, region.height, pixels, region.width, 0, low);
+  }
+  backend = ok ? CaptureBackend::XComposite : segment ? CaptureBackend::XShm : CaptureBackend::XGetImage;
+  if (!ok) {
+    ok = grab_rect(display, target, attr, segment, region.x, region.y, region.width, region.height, pixels, region.width, 0, low);
+  }
+
+  if (pixmap != None) XFreePixmap(display, pixmap);
+  if (composite) XCompositeUnredirectWindow(display, target, CompositeRedirectAutomatic);
+  XSync(display, False);
+
+  XSetErrorHandler(old_handler);
+
+  if (!ok) {
+    regions.clear();
+    return false;
+  }
+
+  window   = target;
+  captured = true;
+  return true;
+#else
+  return false;
+#endif
+}
+
+// Where the pixels of a dump file are and how they are laid out.
+struct DumpLayout {
+  int width;
+  int height;
+  PixelFormat format;
+  size_t offset;
+  size_t pitch;
+  int maxval = 255; // of PNM samples
+};
+
+static uint32_t read_be32(const uint8_t* p) {
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+// X Window Dump, as written by xwd or exposed by Xvfb -fbdir. Only true color
+// ZPixmaps with 8 bits per channel are supported.
+static bool parse_xwd(const uint8_t* data, size_t size, DumpLayout& layout) {
+  static constexpr size_t header_fields = 25;
+  if (size < header_fields * 4) return false;
+
+  uint32_t header[header_fields];
+  for (size_t i = 0; i < header_fields; i++) {
+    header[i] = read_be32(data + i * 4);
+  }
+
+  uint32_t header_size = header[0], version = header[1], format = header[2];
+  uint32_t width = header[4], height = header[5], byte_order = header[7];
+  uint32_t bits_per_pixel = header[11], bytes_per_line = header[12];
+  uint32_t red_mask = header[14], blue_mask = header[16], ncolors = header[19];
+  if (version != 7 || format != 2 || header_size < header_fields * 4) return false;
+
+  bool lsb_first = byte_order == 0;
+  if (bits_per_pixel == 32 && red_mask == 0xFF0000 && blue_mask == 0xFF) {
+    layout.format = lsb_first ? PixelFormat::BGRX32 : PixelFormat::XRGB32;
+  } else if (bits_per_pixel == 32 && red_mask == 0xFF && blue_mask == 0xFF0000 && lsb_first) {
+    layout.format = PixelFormat::RGBA32;
+  } else if (bits_per_pixel == 24 && red_mask == 0xFF0000 && blue_mask == 0xFF) {
+    layout.format = lsb_first ? PixelFormat::BGR24 : PixelFormat::RGB24;
+  } else {
+    return false;
+  }
+
+  // the header is followed by the window name and a colormap of 12 byte entries
+  layout.width  = width;
+  layout.height = height;
+  layout.offset = (size_t)header_size + (size_t)ncolors * 12;
+  layout.pitch  = bytes_per_line;
+  return true;
+}
+
+// Binary PPM (P6) and PGM (P5) with 8 bit samples. Samples below a maxval
+// smaller than 255 are scaled up when converting.
+static bool parse_pnm(const uint8_t* data, size_t size, DumpLayout& layout) {
+  if (size < 2 || data[0] != 'P' || (data[1] != '6' && data[1] != '5')) return false;
+
+  size_t pos = 2;
+  int values[3];
+  for (int& value : values) {
+    while (pos < size && (std::isspace(data[pos]) || data[pos] == '#')) {
+      if (data[pos] == '#') {
+        while (pos < size && data[pos] != '\n') pos++;
+      } else {
+        pos++;
+      }
+    }
+    if (pos >= size || !std::isdigit(data[pos])) return false;
+
+    value = 0;
+    while (pos < size && std::isdigit(data[pos]) && value < (1 << 24)) {
+      value = value * 10 + (data[pos++] - '0');
+    }
+  }
+
+  // a single whitespace separates the header from the samples
+  if (pos >= size || !std::isspace(data[pos]) || values[2] < 1 || values[2] > 255) return false;
+
+  layout.width  = values[0];
+  layout.height = values[1];
+  layout.format = data[1] == '6' ? PixelFormat::RGB24 : PixelFormat::GRAY8;
+  layout.offset = pos + 1;
+  layout.pitch  = (size_t)layout.width * pixel_format_bytes(layout.format);
+  layout.maxval = values[2];
+  return true;
+}
+
+// Maps options.file into memory. When the file already holds tightly packed
+// RGB rows the capture reads the mapping in place, only the pages that are
+// actually looked at get read from disk. Other layouts are kept as raw pixels
+// in the mapping (see Capture::is_raw), the textures and lookups convert only
+// what they need. PNMs with a maxval below 255 are the exception, they are
+// converted and scaled up front.
+bool Capture::capture_mapped(const CaptureOptions& options) {
+  captured = false;
+  window   = 0;
+  release();
+
+  bool opened = options.copy_file ? mapping.read(options.file.c_str()) : mapping.open(options.file.c_str());
+  if (!opened) return false;
+
+  DumpLayout layout;
+  if (options.raw_width > 0 && options.raw_height > 0) {
+    layout.width  = options.raw_width;
+    layout.height = options.raw_height;
+    layout.format = options.raw_format;
+    layout.offset = 0;
+    layout.pitch  = (size_t)layout.width * pixel_format_bytes(layout.format);
+  } else if (!parse_xwd(mapping.data, mapping.size, layout) && !parse_pnm(mapping.data, mapping.size, layout)) {
+    mapping.close();
+    return false;
+  }
+
+  size_t row_bytes = (size_t)layout.width * pixel_format_bytes(layout.format);
+  if (layout.width <= 0 || layout.height <= 0 || layout.pitch < row_bytes ||
+      layout.offset + layout.pitch * (layout.height - 1) + row_bytes > mapping.size) {
+    mapping.close();
+    return false;
+  }
+
+  width   = layout.width;
+  height  = layout.height;
+  regions = {{0, 0, width, height, 0}};
+
+  const uint8_t* src = mapping.data + layout.offset;
+  if (layout.maxval != 255) {
+    RGB* dst = new RGB[(size_t)width * height];
+    convert_to_rgb(layout.format, src, layout.pitch, dst, width, width, height);
+    mapping.close();
+
+    uint8_t scale[256];
+    for (int i = 0; i < 256; i++) {
+      scale[i] = (uint8_t)std::min(255, (i * 255 + layout.maxval / 2) / layout.maxval);
+    }
+    for (size_t i = 0; i < (size_t)width * height; i++) {
+      dst[i] = {scale[dst[i].r], scale[dst[i].g], scale[dst[i].b]};
+    }
+
+    pixels   = dst;
+    capacity = (size_t)width * height;
+  } else if (layout.format == PixelFormat::RGB24 && layout.pitch == row_bytes) {
+    pixels        = (RGB*)src;
+    pixels_mapped = true;
+  } else {
+    raw_data    = src;
+    raw_format  = layout.format;
+    raw_regions = {{0, (ptrdiff_t)layout.pitch}};
+  }
+
+  backend  = CaptureBackend::Mapped;
+  captured = true;
+  return true;
+}
+
+// Opens options.file, mapped when it is a dump and decoded otherwise. Big
+// images are turned into a tile pyramid the first time they are opened,
+// which is reused as long as the file doesn't change.
+bool Capture::capture_file(const CaptureOptions& options) {
+  std::string cache;
+  uint64_t source_size = 0;
+  int64_t source_time  = 0;
+  if (!options.tile_cache_dir.empty()) {
+    std::error_code error;
+    std::filesystem::path source = std::filesystem::absolute(options.file, error);
+    if (!error) source_size = std::filesystem::file_size(source, error);
+    if (!error) source_time = std::filesystem::last_write_time(source, error).time_since_epoch().count();
+    if (!error) {
+      // the same file can be read with different raw geometries
+      std::stringstream key;
+      key << source.string() << ':' << options.raw_width << 'x' << options.raw_height << ':' << (int)options.raw_format;
+
+      std::stringstream name;
+      name << std::hex << std::setw(16) << std::setfill('0') << std::hash<std::string>{}(key.str()) << ".tiles";
+      cache = (std::filesystem::path(options.tile_cache_dir) / name.str()).string();
+
+      if (open_tiled(cache, source_size, source_time)) return true;
+    }
+  }
+
+  if (!capture_mapped(options) && !(options.raw_width <= 0 && capture(options.file.c_str()))) return false;
+  if (cache.empty() || (size_t)width * height < options.tile_min_pixels) return true;
+
+  // Dumps are converted a band at a time straight from the mapping, see
+  // capture_mapped, and the band's pages are given back once it is read. The
+  // image is never held in full, neither decoded nor mapped.
+  std::error_code error;
+  std::filesystem::create_directories(options.tile_cache_dir, error);
+  bool built = TilePyramid::build(cache, width, height, source_size, source_time, [&](int y, int h, RGB* dst) {
+    read(0, y, width, h, dst, width, {0, 0, 0});
+    if (!mapping.is_open()) return;
+
+    ptrdiff_t pitch    = (ptrdiff_t)width * sizeof(RGB);
+    const uint8_t* src = is_raw() ? raw_rows(0, pitch) : (const uint8_t*)pixels;
+    mapping.drop_pages(src + y * pitch - mapping.data, (size_t)h * pitch);
+  });
+
+  // without a cache the image is shown as it was loaded
+  if (built) open_tiled(cache, source_size, source_time);
+  return true;
+}
+
+bool Capture::open_tiled(const std::string& path, uint64_t source_size, int64_t source_time) {
+  TilePyramid opened;
+  if (!opened.open(path, source_size, source_time)) return false;
+
+  release();
+  pyramid.swap(opened);
+
+  captured = false;
+  window   = 0;
+  depth    = 8;
+  low_bits.clear();
+  width  = pyramid.level_width(0);
+  height = pyramid.level_height(0);
+
+  // the mapping is copy-on-write, writing pixels never changes the cache
+  pixels = (RGB*)pyramid.tile(0, 0, 0);
+  regions.clear();
+  for (int ty = 0; ty < pyramid.tiles_y(0); ty++) {
+    for (int tx = 0; tx < pyramid.tiles_x(0); tx++) {
+      size_t offset = pyramid.tile(0, tx, ty) - pyramid.tile(0, 0, 0);
+      regions.push_back({tx * TilePyramid::tile_size, ty * TilePyramid::tile_size, pyramid.tile_width(0, tx), pyramid.tile_height(0, ty), offset});
+    }
+  }
+
+  backend  = CaptureBackend::Tiled;
+  captured = true;
+  return true;
+}
+
+// Grabs the area over and over while the user scrolls it and stitches the
+// frames together. The result is one region at 0, 0 as tall as everything
+// that scrolled by.
+bool Capture::capture_scroll(const CaptureOptions& options) {
+  CaptureOptions frame_options = options;
+  frame_options.scroll         = false;
+
+  Capture frame;
+  std::vector<RGB> rows;
+  ScrollStitcher stitcher;
+
+  int frame_width  = 0;
+  int frame_height = 0;
+
+  auto last_scroll = std::chrono::steady_clock::now();
+  while (true) {
+    auto grab_start = std::chrono::steady_clock::now();
+    if (!frame.capture(frame_options)) return false;
+
+    // the bounding box of the grabbed regions, e.g. the pre-crop area
+    int x1 = frame.width, y1 = frame.height, x2 = 0, y2 = 0;
+    for (const CaptureRegion& region : frame.regions) {
+      x1 = std::min(x1, region.x);
+      y1 = std::min(y1, region.y);
+      x2 = std::max(x2, region.x + region.width);
+      y2 = std::max(y2, region.y + region.height);
+    }
+    int w = x2 - x1;
+    int h = y2 - y1;
+
+    if (frame_width == 0) {
+      frame_width  = w;
+      frame_height = h;
+      stitcher.reset(w, h);
+    } else if (w != frame_width || h != frame_height) {
+      break; // the area changed size, e.g. the window was resized
+    }
+
+    rows.resize((size_t)w * h);
+    frame.read(x1, y1, w, h, rows.data(), w, {0, 0, 0});
+
+    if (stitcher.add(rows.data()) > 0) last_scroll = std::chrono::steady_clock::now();
+
+    if (stitcher.get_height() >= options.scroll_max_height) break;
+    if (std::chrono::steady_clock::now() - last_scroll >= std::chrono::milliseconds(options.scroll_idle_ms)) break;
+
+    std::this_thread::sleep_until(grab_start + std::chrono::milliseconds(options.scroll_interval_ms));
+  }
+
+  release();
+
+  width   = stitcher.get_width();
+  height  = std::min(stitcher.get_height(), options.scroll_max_height);
+  regions = {{0, 0, width, height, 0}};
+  reserve((size_t)width * height);
+  std::copy(stitcher.get_pixels().begin(), stitcher.get_pixels().begin() + (size_t)width * height, pixels);
+
+  backend  = CaptureBackend::Stitched;
+  window   = 0;
+  captured = true;
+  return true;
+}
+
+bool Capture::capture_shm(const CaptureOptions& options) {
+  release();
+
+  // attach again even for the same name, the producer may have recreated it
+  if (!shm.attach(options.shm_name)) return false;
+
+  width   = shm.header.width;
+  height  = shm.header.height;
+  regions = {{0, 0, width, height, 0}};
+  show_shm_frame(shm.latest());
+
+  backend  = CaptureBackend::Shm;
+  captured = true;
+  return true;
+}
+
+// Points pixels at the given frame. Frames that are stored as RGB rows are
+// used in place, others are converted into an owned buffer.
+void Capture::show_shm_frame(uint64_t sequence) {
+  static constexpr PixelFormat formats[] = {PixelFormat::RGB24, PixelFormat::BGRX32, PixelFormat::RGBA32, PixelFormat::GRAY8};
+
+  // the copy taken when attaching, the producer can't change it in between
+  const ShmFramesHeader& header = shm.header;
+  const uint8_t* frame          = shm.frame(sequence);
+  PixelFormat format            = formats[header.format];
+
+  if (frame && format == PixelFormat::RGB24 && header.pitch == (uint32_t)width * 3) {
+    if (!pixels_shared) release();
+    pixels        = (RGB*)frame;
+    pixels_shared = true;
+  } else {
+    if (pixels_shared) release();
+    reserve((size_t)width * height);
+    if (frame) {
+      convert_to_rgb(format, frame, header.pitch, pixels, width, width, height);
+    } else {
+      std::fill(pixels, pixels + (size_t)width * height, RGB{0, 0, 0});
+    }
+  }
+
+  shm_sequence = sequence;
+}
+
+bool Capture::poll() {
+  if (!captured || backend != CaptureBackend::Shm) return false;
+
+  uint64_t sequence = shm.latest();
+  if (sequence == shm_sequence) return false;
+
+  show_shm_frame(sequence);
+  return true;
+}
+
+// Decodes filename from a mapping of it instead of reading it into a buffer
+// first. stb converts straight to RGB rows and its buffer becomes pixels, so
+// the decoded image is held only once.
 bool Capture::capture(const char* filename) {
+  // read rather than mapped, a file cut short while it is decoded would
+  // fault in the middle of stb_image
+  MappedFile file;
+  if (!file.read(filename) || file.size > INT_MAX) return false;
+
+  // 16 bit images keep their lower bytes in low_bits
+  if (stbi_is_16_bit_from_memory(file.data, (int)file.size)) return capture_16(file);
+
   int w, h, comp;
-  unsigned char* data = stbi_load(filename, &w, &h, &comp, 0);
+  unsigned char* data = stbi_load_from_memory(file.data, (int)file.size, &w, &h, &comp, 3);
   if (data == nullptr) return false;
 
-  width  = w;
-  stride = w;
-  height = h;
-  pixels = new RGB[width * height];
+  release();
+  captured = false;
+  window   = 0;
+  depth    = 8;
+  low_bits.clear();
+  width       = w;
+  height      = h;
+  regions     = {{0, 0, width, height, 0}};
+  pixels      = (RGB*)data;
+  capacity    = (size_t)width * height;
+  pixels_stbi = true;
 
-  if (!pixels) {
-    stbi_image_free(data);
-    return false;
+  backend  = CaptureBackend::File;
+  captured = true;
+  return true;
+}
+
+bool Capture::capture_16(const MappedFile& file) {
+  int w, h, comp;
+  stbi_us* data = stbi_load_16_from_memory(file.data, (int)file.size, &w, &h, &comp, 3);
+  if (data == nullptr) return false;
+
+  size_t count = (size_t)w * h;
+  low_bits.resize(count);
+
+  // the high bytes are packed into the front of stb's buffer, which is then
+  // kept as pixels. Pixel i is written below where pixel i + 1 is read from.
+  const uint16_t* src = data;
+  RGB* high           = (RGB*)data;
+  for (size_t i = 0; i < count; i++, src += 3) {
+    uint16_t r = src[0], g = src[1], b = src[2];
+    high[i]     = {(uint8_t)(r >> 8), (uint8_t)(g >> 8), (uint8_t)(b >> 8)};
+    low_bits[i] = {(uint8_t)r, (uint8_t)g, (uint8_t)b};
+  }
+
+  // the back half is free now. stb allocates with malloc unless told
+  // otherwise, see stb.cpp, so it is given back with realloc.
+  if (RGB* shrunk = (RGB*)std::realloc(data, count * sizeof(RGB))) high = shrunk;
+
+  release();
+  captured    = false;
+  window      = 0;
+  depth       = 16;
+  width       = w;
+  height      = h;
+  regions     = {{0, 0, width, height, 0}};
+  pixels      = high;
+  capacity    = count;
+  pixels_stbi = true;
+
+  backend  = CaptureBackend::File;
+  captured = true;
+  return true;
+}
+
+void Capture::read(int x, int y, int w, int h, RGB* dst, int dst_stride, RGB fill) const {
+  for (int row = 0; row < h; row++) {
+    std::fill(dst + (size_t)row * dst_stride, dst + (size_t)row * dst_stride + w, fill);
   }
 
-  for (int y = 0; y < height; y++) {
-    for (int x = 0; x < width; x++) {
-      int index = (y * width + x) * comp;
-      RGB rgb;
-      if (comp == 1 || comp == 2) {
-        rgb.r = data[index];
-        rgb.g = data[index];
-        rgb.b = data[index];
-      } else if (comp == 3 || comp == 4) {
-        rgb.r = data[index];
-        rgb.g = data[index + 1];
-        rgb.b = data[index + 2];
+  for (const CaptureRegion& region : regions) {
+    int x1 = std::max(x, region.x);
+    int y1 = std::max(y, region.y);
+    int x2 = std::min(x + w, region.x + region.width);
+    int y2 = std::min(y + h, region.y + region.height);
+    if (x2 <= x1 || y2 <= y1) continue;
+
+    if (is_raw()) {
+      ptrdiff_t pitch;
+      const uint8_t* src = raw_rows(&region - regions.data(), pitch) + (y1 - region.y) * pitch + (size_t)(x1 - region.x) * pixel_format_bytes(raw_format);
+      convert_to_rgb(raw_format, src, pitch, dst + (size_t)(y1 - y) * dst_stride + (x1 - x), dst_stride, x2 - x1, y2 - y1);
+      continue;
+    }
+
+    if (is_compact()) {
+      store.read(&region - regions.data(), x1 - region.x, y1 - region.y, x2 - x1, y2 - y1, dst + (size_t)(y1 - y) * dst_stride + (x1 - x), dst_stride);
+      continue;
+    }
+
+    for (int row = y1; row < y2; row++) {
+      RGB* out       = dst + (size_t)(row - y) * dst_stride + (x1 - x);
+      const RGB* src = pixels + region.offset + (size_t)(row - region.y) * region.width + (x1 - region.x);
+      std::copy(src, src + (x2 - x1), out);
+    }
+  }
+}
+
+// Compressing takes about as long as uploading the capture did, so it is
+// worth it for captures that are looked at for a while.
+bool Capture::compact() {
+  if (!can_compact()) return false;
+  expand();
+
+  TileStore compressed;
+  compressed.compress(regions, pixels);
+  return compact(compressed);
+}
+
+bool Capture::can_compact() const {
+  // mapped pixels are the system's to page out
+  if (!captured || is_compact() || !writable() || mapping.is_open() || is_tiled()) return false;
+  return pixels || is_raw();
+}
+
+bool Capture::compact(TileStore& compressed) {
+  if (!can_compact() || !pixels) return false;
+
+  size_t count = 0;
+  for (const CaptureRegion& region : regions) {
+    count += (size_t)region.width * region.height;
+  }
+  if (compressed.size() > count * sizeof(RGB) / 4 * 3) return false;
+
+  release();
+  store.swap(compressed);
+  return true;
+}
+
+void Capture::expand() {
+  if (!is_compact() && !is_raw()) return;
+
+  size_t count = 0;
+  for (const CaptureRegion& region : regions) {
+    count = std::max(count, region.offset + (size_t)region.width * region.height);
+  }
+
+  if (is_raw()) {
+    RGB* converted = new RGB[count];
+    for (size_t i = 0; i < regions.size(); i++) {
+      const CaptureRegion& region = regions[i];
+      ptrdiff_t pitch;
+      const uint8_t* src = raw_rows(i, pitch);
+      convert_to_rgb(raw_format, src, pitch, converted + region.offset, region.width, region.width, region.height);
+    }
+    release();
+    pixels   = converted;
+    capacity = count;
+    return;
+  }
+
+  TileStore compressed;
+  compressed.swap(store);
+  reserve(count);
+  compressed.decompress(pixels);
+}
+
+void Capture::swap(Capture& other) {
+  std::swap(captured, other.captured);
+  std::swap(backend, other.backend);
+  std::swap(width, other.width);
+  std::swap(height, other.height);
+  std::swap(regions, other.regions);
+  std::swap(pixels, other.pixels);
+  std::swap(window, other.window);
+  std::swap(window_x, other.window_x);
+  std::swap(window_y, other.window_y);
+  std::swap(depth, other.depth);
+  std::swap(low_bits, other.low_bits);
+  std::swap(capacity, other.capacity);
+  std::swap(raw_format, other.raw_format);
+  std::swap(raw_data, other.raw_data);
+  std::swap(raw_regions, other.raw_regions);
+  std::swap(raw_owned, other.raw_owned);
+  std::swap(raw_capacity, other.raw_capacity);
+  mapping.swap(other.mapping);
+  std::swap(pixels_mapped, other.pixels_mapped);
+  std::swap(pixels_stbi, other.pixels_stbi);
+  shm.swap(other.shm);
+  pyramid.swap(other.pyramid);
+  store.swap(other.store);
+  std::swap(shm_sequence, other.shm_sequence);
+  std::swap(pixels_shared, other.pixels_shared);
+}
+
+// Compares whole rows with memcmp, which is far quicker than uploading them,
+// and copies only the rows that differ.
+bool Capture::update_from(Capture& other, std::vector<CaptureArea>& changed) {
+  if (!captured || !other.captured || !writable()) return false;
+  if (other.width != width || other.height != height || other.depth != depth) return false;
+
+  // the pyramids are mapped files, other's replaces this one's and only the
+  // tiles that differ are reported, a run of them in a row as one area
+  if (is_tiled() || other.is_tiled()) {
+    if (!is_tiled() || !other.is_tiled() || other.pyramid.get_levels() != pyramid.get_levels()) return false;
+
+    int size = TilePyramid::tile_size;
+    for (int ty = 0; ty < pyramid.tiles_y(0); ty++) {
+      int first = -1;
+      for (int tx = 0; tx <= pyramid.tiles_x(0); tx++) {
+        bool differs = false;
+        if (tx < pyramid.tiles_x(0)) {
+          size_t bytes = (size_t)pyramid.tile_width(0, tx) * pyramid.tile_height(0, ty) * sizeof(RGB);
+          differs      = std::memcmp(pyramid.tile(0, tx, ty), other.pyramid.tile(0, tx, ty), bytes) != 0;
+        }
+
+        if (differs && first < 0) {
+          first = tx;
+        } else if (!differs && first >= 0) {
+          changed.push_back({first * size, ty * size, std::min(width, tx * size) - first * size, pyramid.tile_height(0, ty)});
+          first = -1;
+        }
       }
-      pixels[y * width + x] = rgb;
     }
+    swap(other);
+    return true;
   }
 
-  stbi_image_free(data);
+  expand();
+  if (other.regions.size() != regions.size() || other.low_bits.size() != low_bits.size()) return false;
+  for (size_t i = 0; i < regions.size(); i++) {
+    const CaptureRegion& a = regions[i];
+    const CaptureRegion& b = other.regions[i];
+    if (a.x != b.x || a.y != b.y || a.width != b.width || a.height != b.height) return false;
+  }
 
-  captured = true;
+  for (size_t i = 0; i < regions.size(); i++) {
+    const CaptureRegion& region = regions[i];
+
+    // raw captures, e.g. a dump written again, are converted a row at a time
+    std::vector<RGB> converted(other.pixels ? 0 : region.width);
+    auto other_row = [&](int y) {
+      if (other.pixels) return (const RGB*)other.pixels + other.regions[i].offset + (size_t)y * region.width;
+      other.read(region.x, region.y + y, region.width, 1, converted.data(), region.width, {0, 0, 0});
+      return (const RGB*)converted.data();
+    };
+
+    size_t row_size = (size_t)region.width * sizeof(RGB);
+    int first       = -1;
+    for (int y = 0; y <= region.height; y++) {
+      bool differs = false;
+      if (y < region.height) {
+        size_t row = region.offset + (size_t)y * region.width;
+        differs    = std::memcmp(pixels + row, other_row(y), row_size) != 0 ||
+                  (!low_bits.empty() && std::memcmp(low_bits.data() + row, other.low_bits.data() + other.regions[i].offset + (size_t)y * region.width, row_size) != 0);
+      }
+
+      if (differs && first < 0) {
+        first = y;
+      } else if (!differs && first >= 0) {
+        for (int copy = first; copy < y; copy++) {
+          const RGB* src = other_row(copy);
+          std::copy(src, src + region.width, pixels + region.offset + (size_t)copy * region.width);
+        }
+        if (!low_bits.empty()) {
+          const RGB* src = other.low_bits.data() + other.regions[i].offset + (size_t)first * region.width;
+          std::copy(src, src + (size_t)(y - first) * region.width, low_bits.begin() + region.offset + (size_t)first * region.width);
+        }
+        changed.push_back({region.x, region.y + first, region.width, y - first});
+        first = -1;
+      }
+    }
+  }
   return true;
 }
 
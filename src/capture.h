@@ -1,9 +1,20 @@
 #ifndef _CAPTURE_H_
 #define _CAPTURE_H_
 
+#include <cstddef>
 #include <cstdint>
 #include <fstream>
 #include <iostream>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "convert.h"
+#include "mappedFile.h"
+#include "shmFrames.h"
+#include "tilePyramid.h"
+#include "tileStore.h"
 
 struct RGB {
   uint8_t r;
@@ -11,13 +22,130 @@ struct RGB {
   uint8_t b;
 };
 
+struct RGB16 {
+  uint16_t r;
+  uint16_t g;
+  uint16_t b;
+};
+
+enum class CaptureBackend {
+  Unknown,
+  XShm,
+  XGetImage,
+  XComposite,
+  GDI,
+  File,
+  Mapped,
+  Shm,
+  Stitched,
+  Tiled,
+};
+
+const char* capture_backend_name(CaptureBackend backend);
+
+// X error handlers are process wide. Screen and window grabs install theirs
+// while holding this lock, so whoever else swaps handlers on another thread,
+// e.g. SDL creating a window or an OpenGL context, has to hold it as well.
+std::mutex& capture_error_handler_lock();
+
+// A captured rectangle of the screen, usually one monitor. Its pixels are
+// stored row after row starting at Capture::pixels[offset], so the row stride
+// is the region width.
+struct CaptureRegion {
+  int x;
+  int y;
+  int width;
+  int height;
+  size_t offset;
+
+  bool contains(int px, int py) const {
+    return px >= x && px < x + width && py >= y && py < y + height;
+  }
+};
+
+// A rectangle of a capture in world coordinates, e.g. an area that changed.
+struct CaptureArea {
+  int x;
+  int y;
+  int width;
+  int height;
+};
+
+struct CaptureOptions {
+  // grab every region on its own thread and X display connection
+  bool parallel = false;
+
+  // only grab this rectangle of the screen, a width or height <= 0 extends
+  // it to the right or bottom edge. World coordinates stay screen coordinates.
+  // Window captures take the part of the window within the area.
+  int area_x = 0;
+  int area_y = 0;
+  int area_w = 0;
+  int area_h = 0;
+
+  // capture only this X11 window instead of the screen, through its
+  // XComposite backing pixmap so covered parts are captured too where a
+  // compositing manager keeps them painted. World coordinates are then
+  // relative to the window.
+  unsigned long window = 0;
+
+  // load this file instead of grabbing the screen. XWD and binary PPM dumps
+  // are mapped into memory, everything else is decoded with stb_image.
+  std::string file;
+
+  // read dumps into memory instead of mapping them, for files that are
+  // rewritten while they are shown, see --watch
+  bool copy_file = false;
+
+  // files with at least tile_min_pixels pixels are turned into a tile
+  // pyramid in tile_cache_dir when they are opened the first time, later
+  // opens map the pyramid instead of loading the file. Empty to disable.
+  std::string tile_cache_dir;
+  size_t tile_min_pixels = 0;
+
+  // read file as headerless pixels of this size and format
+  int raw_width          = 0;
+  int raw_height         = 0;
+  PixelFormat raw_format = PixelFormat::RGB24;
+
+  // show the frames another process writes into this POSIX shared memory
+  // object, see shmFrames.h for its layout.
+  std::string shm_name;
+
+  // keep grabbing the area (or window) while the user scrolls it and stitch
+  // the frames into one tall capture. Stops once nothing scrolled for
+  // scroll_idle_ms or the capture reached scroll_max_height rows.
+  bool scroll            = false;
+  int scroll_interval_ms = 100;
+  int scroll_idle_ms     = 2000;
+  int scroll_max_height  = 30000;
+};
+
+// Helpers to pick the window for CaptureOptions::window, both return 0 when no
+// window was found or window capture is not supported.
+unsigned long capture_find_window(const char* name);
+unsigned long capture_pick_window();
+
 struct Capture {
 public:
   ~Capture();
 
-  bool capture();
+  // Grabs the screen. Can be called again to recapture, the pixel buffer is
+  // reused when the new capture fits into it.
+  bool capture(const CaptureOptions& options = {});
   bool capture(const char* filename);
 
+  // Checks whether the source has a newer frame than the one in pixels and
+  // switches to it. Returns true when pixels changed. Only shared memory
+  // captures ever change this way.
+  bool poll();
+
+  // false when pixels point into memory another process owns, they must not
+  // be written to then.
+  bool writable() const {
+    return !pixels_shared;
+  }
+
   bool in_bound(int x, int y) {
     if (!captured) return false;
     if (x >= width || x < 0) return false;
@@ -25,24 +153,194 @@ public:
     return true;
   }
 
+  // true when the capture is a tile pyramid, see CaptureOptions::tile_cache_dir
+  bool is_tiled() const {
+    return pyramid.is_open();
+  }
+
+  // true when the pixels come from grabbing the whole screen
+  bool is_screen() const {
+    return captured && !window && (backend == CaptureBackend::XShm || backend == CaptureBackend::XGetImage || backend == CaptureBackend::GDI);
+  }
+
+  const CaptureRegion* region_at(int x, int y) const {
+    // the regions of a tiled capture are its level 0 tiles, row by row
+    if (is_tiled()) {
+      if (x < 0 || y < 0 || x >= width || y >= height) return nullptr;
+      return &regions[(size_t)(y / TilePyramid::tile_size) * pyramid.tiles_x(0) + x / TilePyramid::tile_size];
+    }
+    for (const CaptureRegion& region : regions) {
+      if (region.contains(x, y)) return &region;
+    }
+    return nullptr;
+  }
+
   bool at(int x, int y, RGB& rgb) {
     if (!captured) return false;
     if (x >= width || x < 0) return false;
     if (y >= height || y < 0) return false;
 
-    int index = y * width + x;
-    rgb       = pixels[index];
+    const CaptureRegion* region = region_at(x, y);
+    if (!region) return false;
+
+    if (is_compact()) {
+      rgb = store.at(region - regions.data(), x - region->x, y - region->y);
+      return true;
+    }
+    if (is_raw()) {
+      ptrdiff_t pitch;
+      const uint8_t* row = raw_rows(region - regions.data(), pitch) + (y - region->y) * pitch;
+      convert_to_rgb(raw_format, row + (size_t)(x - region->x) * pixel_format_bytes(raw_format), 0, &rgb, 1, 1, 1, 1);
+      return true;
+    }
+
+    size_t index = region->offset + (size_t)(y - region->y) * region->width + (x - region->x);
+    rgb          = pixels[index];
 
     return true;
   }
 
-  bool captured = false;
-  int width;
-  int height;
-  int stride;
-  RGB* pixels;
+  // Full precision value at x, y, scaled to 16 bits. Captures without
+  // low_bits are expanded from 8 bits.
+  bool at16(int x, int y, RGB16& rgb) {
+    RGB high;
+    if (!at(x, y, high)) return false;
+
+    RGB low = high;
+    if (!low_bits.empty()) {
+      const CaptureRegion* region = region_at(x, y);
+      low                         = low_bits[region->offset + (size_t)(y - region->y) * region->width + (x - region->x)];
+    }
+    rgb = {(uint16_t)(high.r << 8 | low.r), (uint16_t)(high.g << 8 | low.g), (uint16_t)(high.b << 8 | low.b)};
+    return true;
+  }
+
+  // Forgets the extra precision, for when only pixels is going to be updated
+  // from now on (live mode, recording).
+  void drop_low_bits() {
+    low_bits = {};
+    depth    = 8;
+  }
+
+  // Copies the w x h rectangle at x, y into dst. Pixels that are not covered
+  // by any region (e.g. the gaps between monitors) are set to fill.
+  void read(int x, int y, int w, int h, RGB* dst, int dst_stride, RGB fill) const;
+
+  // Compresses pixels into store and frees them, for while nothing but
+  // lookups need them (at, at16, read). Returns false when the pixels are
+  // not this capture's to free or barely compress, e.g. noise.
+  bool compact();
+
+  // The same in parts: can_compact tells whether compact could free the
+  // pixels, compact(compressed) takes pixels compressed by the caller, e.g.
+  // a few tiles per frame, and swaps them into store.
+  bool can_compact() const;
+  bool compact(TileStore& compressed);
+
+  // Decompresses store, or converts the raw pixels, back into pixels, which
+  // everything writing them needs. Does nothing when pixels are there.
+  void expand();
+
+  bool is_compact() const {
+    return !store.empty();
+  }
+
+  // Screen grabs whose rows already are BGRX, and mapped dumps in other
+  // layouts than RGB rows, keep their pixels as they are instead of
+  // converting them to RGB. Textures in the same format are filled by
+  // copying. pixels is null meanwhile, at and read convert what they look up
+  // and expand converts everything.
+  bool is_raw() const {
+    return raw_data != nullptr;
+  }
+
+  // The first row of region in the raw layout, the rows are pitch bytes apart
+  // (negative for bottom-up images).
+  const uint8_t* raw_rows(size_t region, ptrdiff_t& pitch) const {
+    pitch = raw_regions[region].pitch;
+    return raw_data + raw_regions[region].offset;
+  }
+
+  // bytes held for the raw pixels
+  size_t raw_size() const {
+    return raw_capacity;
+  }
+
+  PixelFormat raw_format = PixelFormat::BGRX32;
+
+  // Exchanges everything, including who owns the pixels, with other. Pixel
+  // pointers stay valid and now belong to the other capture.
+  void swap(Capture& other);
+
+  // Brings this capture up to date with other, a newer version of the same
+  // image, and appends the areas that changed to changed. Rows are compared
+  // within each region, tiled captures compare their level 0 tiles and take
+  // over other's pyramid. Returns false when the two can't be compared, e.g.
+  // because the size changed.
+  bool update_from(Capture& other, std::vector<CaptureArea>& changed);
+
+  bool captured          = false;
+  CaptureBackend backend = CaptureBackend::Unknown;
+  int width  = 0; // bounding box of all regions
+  int height = 0; // bounding box of all regions
+  std::vector<CaptureRegion> regions;
+  RGB* pixels          = nullptr;
+  unsigned long window = 0; // the captured window, 0 for the whole screen
+  int window_x         = 0; // where the window was on the screen
+  int window_y         = 0;
+
+  // Bits per channel of the source, 8 for most captures. Deeper sources (16
+  // bit images, depth 30 X11 visuals) are kept as 16 bit values: pixels holds
+  // the upper byte of every channel, so textures and everything else keep
+  // working on 8 bits, and low_bits the lower byte, laid out like pixels.
+  int depth = 8;
+  std::vector<RGB> low_bits;
+
+  // the levels of a tiled capture, pixels then points at level 0 and every
+  // level 0 tile is a region
+  TilePyramid pyramid;
+
+  // the pixels while the capture is compact, pixels is null then
+  TileStore store;
 
 private:
+  struct RawRegion {
+    ptrdiff_t offset; // of the first row in raw_data
+    ptrdiff_t pitch;
+  };
+
+  RGB* reserve(size_t count);
+  uint8_t* reserve_raw(size_t bytes);
+  void release();
+  bool capture_16(const MappedFile& file);
+  bool capture_window(const CaptureOptions& options);
+  bool capture_mapped(const CaptureOptions& options);
+  bool capture_file(const CaptureOptions& options);
+  bool open_tiled(const std::string& path, uint64_t source_size, int64_t source_time);
+  bool capture_shm(const CaptureOptions& options);
+  bool capture_scroll(const CaptureOptions& options);
+  void show_shm_frame(uint64_t sequence);
+
+  size_t capacity = 0;
+
+  // see is_raw, raw_owned is the buffer raw_data points into
+  const uint8_t* raw_data = nullptr;
+  std::vector<RawRegion> raw_regions;
+  uint8_t* raw_owned  = nullptr;
+  size_t raw_capacity = 0;
+
+  // pixels points straight into mapping when the file is already laid out as
+  // RGB rows, otherwise the raw pixels do.
+  MappedFile mapping;
+  bool pixels_mapped = false;
+
+  // pixels is the buffer stb_image decoded into and is freed by it
+  bool pixels_stbi = false;
+
+  // the same goes for the frames of a shared memory capture
+  ShmFrames shm;
+  uint64_t shm_sequence = 0;
+  bool pixels_shared    = false;
 };
 
 std::string toDecimalString(const RGB& color);
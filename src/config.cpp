@@ -29,6 +29,12 @@ void config_handler(cappyConfig& config, string_view key, string_view value) {
     } else if (sv_compare_insensitive(value, svl("false")) || sv_compare(value, svl("0"))) {
       config.window_fullscreen = false;
     }
+  } else if (sv_compare(key, svl("capture_parallel"))) {
+    if (sv_compare_insensitive(value, svl("true")) || sv_compare(value, svl("1"))) {
+      config.capture_parallel = true;
+    } else if (sv_compare_insensitive(value, svl("false")) || sv_compare(value, svl("0"))) {
+      config.capture_parallel = false;
+    }
   } else if (sv_compare(key, svl("window_pre_crop"))) {
     config_parse_bound(value, config.window_pre_crop);
   } else if (sv_compare(key, svl("background_color"))) {
@@ -37,6 +43,20 @@ void config_handler(cappyConfig& config, string_view key, string_view value) {
     sv_parse_int(value, &config.grid_size);
   } else if (sv_compare(key, svl("grid_color"))) {
     config_parse_color3(value, config.grid_color);
+  } else if (sv_compare(key, svl("record_frames"))) {
+    sv_parse_int(value, &config.record_frames);
+  } else if (sv_compare(key, svl("record_memory_mb"))) {
+    sv_parse_int(value, &config.record_memory_mb);
+  } else if (sv_compare(key, svl("record_spill_file"))) {
+    config.record_spill_file = std::string(value.data, value.length);
+  } else if (sv_compare(key, svl("session_memory_mb"))) {
+    sv_parse_int(value, &config.session_memory_mb);
+  } else if (sv_compare(key, svl("session_texture_mb"))) {
+    sv_parse_int(value, &config.session_texture_mb);
+  } else if (sv_compare(key, svl("tile_min_mpix"))) {
+    sv_parse_int(value, &config.tile_min_mpix);
+  } else if (sv_compare(key, svl("compact_after_s"))) {
+    sv_parse_int(value, &config.compact_after_s);
   }
 }
 
@@ -108,6 +128,7 @@ void config_init(cappyConfig& config) {
   if (!std::filesystem::exists(config_path)) {
     std::ofstream file(config_path);
     file << "window_fullscreen             = false\n"
+            "capture_parallel              = true\n"
             "window_pre_crop               = 0 0 0 0\n"
             "flashlight_size               = 150\n"
             "flashlight_center_inner_color = 255 255 204 25\n"
@@ -115,7 +136,14 @@ void config_init(cappyConfig& config) {
             "flashlight_outer_color        = 51 51 0 50\n"
             "background_color              = 50 50 50\n"
             "grid_size                     = 100\n"
-            "grid_color                    = 200 200 200\n";
+            "grid_color                    = 200 200 200\n"
+            "record_frames                 = 600\n"
+            "record_memory_mb              = 256\n"
+            "record_spill_file             =\n"
+            "session_memory_mb             = 1024\n"
+            "session_texture_mb            = 512\n"
+            "tile_min_mpix                 = 256\n"
+            "compact_after_s               = 10\n";
     file.close();
   }
 
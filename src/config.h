@@ -6,6 +6,7 @@
 
 typedef struct cappyConfig {
   bool window_fullscreen                   = false;
+  bool capture_parallel                    = true;
   int window_pre_crop[4]                   = {0, 0, 0, 0};
   int flashlight_size                      = 100;
   uint8_t flashlight_center_inner_color[4] = {255, 255, 255, 0};
@@ -14,6 +15,13 @@ typedef struct cappyConfig {
   uint8_t background_color[3]              = {50, 50, 50};
   int grid_size                            = 100;
   uint8_t grid_color[3]                    = {50, 50, 50};
+  int record_frames                        = 600;
+  int record_memory_mb                     = 256;
+  std::string record_spill_file;
+  int session_memory_mb                    = 1024;
+  int session_texture_mb                   = 512;
+  int tile_min_mpix                        = 256;
+  int compact_after_s                      = 10;
 } cappyConfig;
 
 void config_init(const std::string& file, cappyConfig& config);
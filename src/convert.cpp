@@ -0,0 +1,494 @@
+#include "convert.h"
+#include "capture.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+  #define CONVERT_X86 1
+  #include <immintrin.h>
+  #if defined(_MSC_VER)
+    #include <intrin.h>
+  #endif
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+  #define CONVERT_TARGET(t) __attribute__((target(t)))
+#else
+  #define CONVERT_TARGET(t)
+#endif
+
+static_assert(sizeof(RGB) == 3, "RGB must be tightly packed");
+
+using RowKernel = void (*)(const uint8_t* src, uint8_t* dst, int width);
+
+// below this many rows per thread, handing out bands costs more than it saves.
+static constexpr int min_rows_per_band = 64;
+
+int pixel_format_bytes(PixelFormat format) {
+  switch (format) {
+    case PixelFormat::BGRX32: return 4;
+    case PixelFormat::XRGB32: return 4;
+    case PixelFormat::RGBA32: return 4;
+    case PixelFormat::RGB24: return 3;
+    case PixelFormat::BGR24: return 3;
+    case PixelFormat::GRAY8: return 1;
+    case PixelFormat::GRAYA8: return 2;
+  }
+  return 0;
+}
+
+// scalar kernels
+
+static void bgrx_row_scalar(const uint8_t* src, uint8_t* dst, int width) {
+  for (int x = 0; x < width; x++) {
+    dst[x * 3 + 0] = src[x * 4 + 2];
+    dst[x * 3 + 1] = src[x * 4 + 1];
+    dst[x * 3 + 2] = src[x * 4 + 0];
+  }
+}
+
+static void xrgb_row_scalar(const uint8_t* src, uint8_t* dst, int width) {
+  for (int x = 0; x < width; x++) {
+    dst[x * 3 + 0] = src[x * 4 + 1];
+    dst[x * 3 + 1] = src[x * 4 + 2];
+    dst[x * 3 + 2] = src[x * 4 + 3];
+  }
+}
+
+static void rgba_row_scalar(const uint8_t* src, uint8_t* dst, int width) {
+  for (int x = 0; x < width; x++) {
+    dst[x * 3 + 0] = src[x * 4 + 0];
+    dst[x * 3 + 1] = src[x * 4 + 1];
+    dst[x * 3 + 2] = src[x * 4 + 2];
+  }
+}
+
+static void rgb_row_scalar(const uint8_t* src, uint8_t* dst, int width) {
+  std::memcpy(dst, src, width * 3);
+}
+
+static void bgr_row_scalar(const uint8_t* src, uint8_t* dst, int width) {
+  for (int x = 0; x < width; x++) {
+    dst[x * 3 + 0] = src[x * 3 + 2];
+    dst[x * 3 + 1] = src[x * 3 + 1];
+    dst[x * 3 + 2] = src[x * 3 + 0];
+  }
+}
+
+static void gray_row_scalar(const uint8_t* src, uint8_t* dst, int width) {
+  for (int x = 0; x < width; x++) {
+    dst[x * 3 + 0] = src[x];
+    dst[x * 3 + 1] = src[x];
+    dst[x * 3 + 2] = src[x];
+  }
+}
+
+static void graya_row_scalar(const uint8_t* src, uint8_t* dst, int width) {
+  for (int x = 0; x < width; x++) {
+    dst[x * 3 + 0] = src[x * 2];
+    dst[x * 3 + 1] = src[x * 2];
+    dst[x * 3 + 2] = src[x * 2];
+  }
+}
+
+static void rgb_to_bgrx_row_scalar(const uint8_t* src, uint8_t* dst, int width) {
+  for (int x = 0; x < width; x++) {
+    dst[x * 4 + 0] = src[x * 3 + 2];
+    dst[x * 4 + 1] = src[x * 3 + 1];
+    dst[x * 4 + 2] = src[x * 3 + 0];
+    dst[x * 4 + 3] = 255;
+  }
+}
+
+static void rgb_to_rgba_row_scalar(const uint8_t* src, uint8_t* dst, int width) {
+  for (int x = 0; x < width; x++) {
+    dst[x * 4 + 0] = src[x * 3 + 0];
+    dst[x * 4 + 1] = src[x * 3 + 1];
+    dst[x * 4 + 2] = src[x * 3 + 2];
+    dst[x * 4 + 3] = 255;
+  }
+}
+
+#if CONVERT_X86
+// pshufb is SSSE3, plain SSE2 has no byte shuffle to drop every 4th byte with.
+
+// packs 16 four byte pixels into 48 bytes using the given 4 -> 3 shuffle.
+CONVERT_TARGET("ssse3")
+static inline int pack4_ssse3(const uint8_t* src, uint8_t* dst, int width, __m128i mask) {
+  int x = 0;
+  for (; x + 16 <= width; x += 16) {
+    __m128i a = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + x * 4 + 0)), mask);
+    __m128i b = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + x * 4 + 16)), mask);
+    __m128i c = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + x * 4 + 32)), mask);
+    __m128i d = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + x * 4 + 48)), mask);
+
+    // each register holds 12 bytes, stitch them into three full registers
+    _mm_storeu_si128((__m128i*)(dst + x * 3 + 0), _mm_or_si128(a, _mm_slli_si128(b, 12)));
+    _mm_storeu_si128((__m128i*)(dst + x * 3 + 16), _mm_or_si128(_mm_srli_si128(b, 4), _mm_slli_si128(c, 8)));
+    _mm_storeu_si128((__m128i*)(dst + x * 3 + 32), _mm_or_si128(_mm_srli_si128(c, 8), _mm_slli_si128(d, 4)));
+  }
+  return x;
+}
+
+CONVERT_TARGET("ssse3")
+static void bgrx_row_ssse3(const uint8_t* src, uint8_t* dst, int width) {
+  const __m128i mask = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+  int x              = pack4_ssse3(src, dst, width, mask);
+  bgrx_row_scalar(src + x * 4, dst + x * 3, width - x);
+}
+
+CONVERT_TARGET("ssse3")
+static void xrgb_row_ssse3(const uint8_t* src, uint8_t* dst, int width) {
+  const __m128i mask = _mm_setr_epi8(1, 2, 3, 5, 6, 7, 9, 10, 11, 13, 14, 15, -1, -1, -1, -1);
+  int x              = pack4_ssse3(src, dst, width, mask);
+  xrgb_row_scalar(src + x * 4, dst + x * 3, width - x);
+}
+
+CONVERT_TARGET("ssse3")
+static void rgba_row_ssse3(const uint8_t* src, uint8_t* dst, int width) {
+  const __m128i mask = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+  int x              = pack4_ssse3(src, dst, width, mask);
+  rgba_row_scalar(src + x * 4, dst + x * 3, width - x);
+}
+
+// expands 16 gray values into 48 bytes.
+CONVERT_TARGET("ssse3")
+static inline void expand_gray16_ssse3(__m128i g, uint8_t* dst) {
+  const __m128i m0 = _mm_setr_epi8(0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5);
+  const __m128i m1 = _mm_setr_epi8(5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10, 10);
+  const __m128i m2 = _mm_setr_epi8(10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 14, 14, 14, 15, 15, 15);
+  _mm_storeu_si128((__m128i*)(dst + 0), _mm_shuffle_epi8(g, m0));
+  _mm_storeu_si128((__m128i*)(dst + 16), _mm_shuffle_epi8(g, m1));
+  _mm_storeu_si128((__m128i*)(dst + 32), _mm_shuffle_epi8(g, m2));
+}
+
+CONVERT_TARGET("ssse3")
+static void gray_row_ssse3(const uint8_t* src, uint8_t* dst, int width) {
+  int x = 0;
+  for (; x + 16 <= width; x += 16) {
+    expand_gray16_ssse3(_mm_loadu_si128((const __m128i*)(src + x)), dst + x * 3);
+  }
+  gray_row_scalar(src + x, dst + x * 3, width - x);
+}
+
+CONVERT_TARGET("ssse3")
+static void graya_row_ssse3(const uint8_t* src, uint8_t* dst, int width) {
+  const __m128i even = _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, -1, -1, -1, -1, -1, -1, -1, -1);
+  int x              = 0;
+  for (; x + 16 <= width; x += 16) {
+    __m128i lo = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + x * 2 + 0)), even);
+    __m128i hi = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + x * 2 + 16)), even);
+    expand_gray16_ssse3(_mm_unpacklo_epi64(lo, hi), dst + x * 3);
+  }
+  graya_row_scalar(src + x * 2, dst + x * 3, width - x);
+}
+
+// expands 16 three byte pixels into 64 bytes using the given 3 -> 4 shuffle,
+// the fourth byte of every pixel is set to 255.
+CONVERT_TARGET("ssse3")
+static inline int expand3_ssse3(const uint8_t* src, uint8_t* dst, int width, __m128i mask) {
+  const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+  int x               = 0;
+  for (; x + 16 <= width; x += 16) {
+    __m128i a = _mm_loadu_si128((const __m128i*)(src + x * 3 + 0));
+    __m128i b = _mm_loadu_si128((const __m128i*)(src + x * 3 + 16));
+    __m128i c = _mm_loadu_si128((const __m128i*)(src + x * 3 + 32));
+
+    // line up the 12 bytes of every 4 pixels at the start of a register
+    _mm_storeu_si128((__m128i*)(dst + x * 4 + 0), _mm_or_si128(_mm_shuffle_epi8(a, mask), alpha));
+    _mm_storeu_si128((__m128i*)(dst + x * 4 + 16), _mm_or_si128(_mm_shuffle_epi8(_mm_alignr_epi8(b, a, 12), mask), alpha));
+    _mm_storeu_si128((__m128i*)(dst + x * 4 + 32), _mm_or_si128(_mm_shuffle_epi8(_mm_alignr_epi8(c, b, 8), mask), alpha));
+    _mm_storeu_si128((__m128i*)(dst + x * 4 + 48), _mm_or_si128(_mm_shuffle_epi8(_mm_srli_si128(c, 4), mask), alpha));
+  }
+  return x;
+}
+
+CONVERT_TARGET("ssse3")
+static void rgb_to_bgrx_row_ssse3(const uint8_t* src, uint8_t* dst, int width) {
+  const __m128i mask = _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+  int x              = expand3_ssse3(src, dst, width, mask);
+  rgb_to_bgrx_row_scalar(src + x * 3, dst + x * 4, width - x);
+}
+
+CONVERT_TARGET("ssse3")
+static void rgb_to_rgba_row_ssse3(const uint8_t* src, uint8_t* dst, int width) {
+  const __m128i mask = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+  int x              = expand3_ssse3(src, dst, width, mask);
+  rgb_to_rgba_row_scalar(src + x * 3, dst + x * 4, width - x);
+}
+
+// packs 8 four byte pixels per iteration. pshufb works per 128 bit lane, so each
+// lane ends up with 12 bytes that a cross lane permute moves next to each other.
+CONVERT_TARGET("avx2")
+static inline int pack4_avx2(const uint8_t* src, uint8_t* dst, int width, __m256i mask) {
+  const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7);
+  int x               = 0;
+  for (; x + 8 <= width; x += 8) {
+    __m256i v = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(src + x * 4)), mask);
+    v         = _mm256_permutevar8x32_epi32(v, lanes);
+    _mm_storeu_si128((__m128i*)(dst + x * 3), _mm256_castsi256_si128(v));
+    _mm_storel_epi64((__m128i*)(dst + x * 3 + 16), _mm256_extracti128_si256(v, 1));
+  }
+  return x;
+}
+
+CONVERT_TARGET("avx2")
+static void bgrx_row_avx2(const uint8_t* src, uint8_t* dst, int width) {
+  const __m256i mask = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+  int x              = pack4_avx2(src, dst, width, mask);
+  bgrx_row_scalar(src + x * 4, dst + x * 3, width - x);
+}
+
+CONVERT_TARGET("avx2")
+static void xrgb_row_avx2(const uint8_t* src, uint8_t* dst, int width) {
+  const __m256i mask = _mm256_setr_epi8(1, 2, 3, 5, 6, 7, 9, 10, 11, 13, 14, 15, -1, -1, -1, -1,
+                                        1, 2, 3, 5, 6, 7, 9, 10, 11, 13, 14, 15, -1, -1, -1, -1);
+  int x              = pack4_avx2(src, dst, width, mask);
+  xrgb_row_scalar(src + x * 4, dst + x * 3, width - x);
+}
+
+CONVERT_TARGET("avx2")
+static void rgba_row_avx2(const uint8_t* src, uint8_t* dst, int width) {
+  const __m256i mask = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                                        0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+  int x              = pack4_avx2(src, dst, width, mask);
+  rgba_row_scalar(src + x * 4, dst + x * 3, width - x);
+}
+
+static bool cpu_has_ssse3() {
+  #if defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 1);
+  return (info[2] & (1 << 9)) != 0;
+  #else
+  return __builtin_cpu_supports("ssse3");
+  #endif
+}
+
+static bool cpu_has_avx2() {
+  #if defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 1);
+  bool osxsave = (info[2] & (1 << 27)) != 0;
+  if (!osxsave || (_xgetbv(0) & 0x6) != 0x6) return false;
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+  #else
+  return __builtin_cpu_supports("avx2");
+  #endif
+}
+#endif
+
+struct Kernels {
+  RowKernel bgrx  = bgrx_row_scalar;
+  RowKernel xrgb  = xrgb_row_scalar;
+  RowKernel rgba  = rgba_row_scalar;
+  RowKernel rgb   = rgb_row_scalar;
+  RowKernel bgr   = bgr_row_scalar;
+  RowKernel gray  = gray_row_scalar;
+  RowKernel graya = graya_row_scalar;
+
+  RowKernel to_bgrx = rgb_to_bgrx_row_scalar;
+  RowKernel to_rgba = rgb_to_rgba_row_scalar;
+
+  ConvertLevel level = ConvertLevel::Scalar;
+
+  RowKernel get(PixelFormat format) const {
+    switch (format) {
+      case PixelFormat::BGRX32: return bgrx;
+      case PixelFormat::XRGB32: return xrgb;
+      case PixelFormat::RGBA32: return rgba;
+      case PixelFormat::RGB24: return rgb;
+      case PixelFormat::BGR24: return bgr;
+      case PixelFormat::GRAY8: return gray;
+      case PixelFormat::GRAYA8: return graya;
+    }
+    return nullptr;
+  }
+};
+
+// The kernels of level, or of the best level below it the CPU supports.
+static Kernels level_kernels(ConvertLevel level) {
+  Kernels k;
+#if CONVERT_X86
+  if (level >= ConvertLevel::SSSE3 && cpu_has_ssse3()) {
+    k.bgrx  = bgrx_row_ssse3;
+    k.xrgb  = xrgb_row_ssse3;
+    k.rgba  = rgba_row_ssse3;
+    k.gray  = gray_row_ssse3;
+    k.graya = graya_row_ssse3;
+
+    k.to_bgrx = rgb_to_bgrx_row_ssse3;
+    k.to_rgba = rgb_to_rgba_row_ssse3;
+    k.level   = ConvertLevel::SSSE3;
+  }
+  if (level >= ConvertLevel::AVX2 && cpu_has_avx2()) {
+    k.bgrx  = bgrx_row_avx2;
+    k.xrgb  = xrgb_row_avx2;
+    k.rgba  = rgba_row_avx2;
+    k.level = ConvertLevel::AVX2;
+  }
+#endif
+  return k;
+}
+
+static Kernels& best_kernels() {
+  static Kernels kernels = level_kernels(ConvertLevel::AVX2);
+  return kernels;
+}
+
+ConvertLevel convert_set_level(ConvertLevel level) {
+  best_kernels() = level_kernels(level);
+  return best_kernels().level;
+}
+
+// Threads that take bands off run_bands. They are started on first use and
+// kept, update_mips converts small rectangles on every frame and starting
+// threads for each would cost more than the conversion. One caller at a time
+// uses the pool, others convert on their own thread meanwhile.
+class BandPool {
+public:
+  static BandPool& get() {
+    // never destroyed, the threads wait for work until the process exits
+    static BandPool* pool = new BandPool();
+    return *pool;
+  }
+
+  bool try_run(int bands, int rows_per_band, int height, const std::function<void(int y_begin, int y_end)>& rows) {
+    if (busy.exchange(true)) return false;
+
+    Job job = {&rows, bands, rows_per_band, height};
+    {
+      std::lock_guard<std::mutex> guard(mutex);
+      current = &job;
+      generation++;
+    }
+    wake.notify_all();
+
+    // the calling thread takes bands too, and waits for the ones taken by
+    // workers before job goes out of scope
+    job.work();
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      current = nullptr;
+      finished.wait(lock, [&]() { return job.users == 0; });
+    }
+
+    busy = false;
+    return true;
+  }
+
+private:
+  struct Job {
+    const std::function<void(int y_begin, int y_end)>* rows;
+    int bands;
+    int rows_per_band;
+    int height;
+    std::atomic<int> next = 0;
+    int users             = 0; // workers on the job, guarded by mutex
+
+    void work() {
+      for (int band = next++; band < bands; band = next++) {
+        int y_begin = band * rows_per_band;
+        if (y_begin < height) (*rows)(y_begin, std::min(height, y_begin + rows_per_band));
+      }
+    }
+  };
+
+  BandPool() {
+    unsigned count = std::max(1u, std::thread::hardware_concurrency()) - 1;
+    for (unsigned i = 0; i < count; i++) {
+      std::thread(&BandPool::run, this).detach();
+    }
+  }
+
+  void run() {
+    uint64_t seen = 0;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      wake.wait(lock, [&]() { return current && generation != seen; });
+      seen     = generation;
+      Job* job = current;
+      job->users++;
+
+      lock.unlock();
+      job->work();
+      lock.lock();
+
+      if (--job->users == 0) finished.notify_all();
+    }
+  }
+
+  std::atomic<bool> busy = false;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable finished;
+  Job* current        = nullptr;
+  uint64_t generation = 0;
+};
+
+// Calls rows(y_begin, y_end) over 0..height, split into bands on up to
+// max_threads threads.
+static void run_bands(int height, int max_threads, const std::function<void(int y_begin, int y_end)>& rows) {
+  if (height <= 0) return;
+
+  if (max_threads <= 0) max_threads = std::max(1u, std::thread::hardware_concurrency());
+  int bands = std::min(max_threads, height / min_rows_per_band);
+  if (bands <= 1) {
+    rows(0, height);
+    return;
+  }
+
+  int rows_per_band = (height + bands - 1) / bands;
+  if (!BandPool::get().try_run(bands, rows_per_band, height, rows)) rows(0, height);
+}
+
+// Runs kernel over all rows, split into bands on up to max_threads threads.
+static void convert_bands(RowKernel kernel, const uint8_t* src, ptrdiff_t src_pitch, uint8_t* dst, ptrdiff_t dst_pitch, int width, int height, int max_threads) {
+  if (width <= 0) return;
+  run_bands(height, max_threads, [&](int y_begin, int y_end) {
+    for (int y = y_begin; y < y_end; y++) {
+      kernel(src + y * src_pitch, dst + y * dst_pitch, width);
+    }
+  });
+}
+
+void convert_to_rgb(PixelFormat format, const uint8_t* src, ptrdiff_t src_pitch, RGB* dst, int dst_stride, int width, int height, int max_threads) {
+  convert_bands(best_kernels().get(format), src, src_pitch, (uint8_t*)dst, (ptrdiff_t)dst_stride * sizeof(RGB), width, height, max_threads);
+}
+
+void convert_from_rgb(PixelFormat format, const RGB* src, int src_stride, uint8_t* dst, ptrdiff_t dst_pitch, int width, int height, int max_threads) {
+  const Kernels& kernels = best_kernels();
+  RowKernel kernel       = format == PixelFormat::RGBA32 ? kernels.to_rgba : kernels.to_bgrx;
+  convert_bands(kernel, (const uint8_t*)src, (ptrdiff_t)src_stride * sizeof(RGB), dst, dst_pitch, width, height, max_threads);
+}
+
+void downsample_rgb(const RGB* src, int src_stride, RGB* dst, int dst_stride, int width, int height, int max_threads) {
+  if (width <= 0) return;
+  int dst_width  = (width + 1) / 2;
+  int dst_height = (height + 1) / 2;
+  run_bands(dst_height, max_threads, [&](int y_begin, int y_end) {
+    for (int y = y_begin; y < y_end; y++) {
+      const RGB* row0 = src + (size_t)(2 * y) * src_stride;
+      // odd heights repeat the last row
+      const RGB* row1 = 2 * y + 1 < height ? row0 + src_stride : row0;
+      RGB* out        = dst + (size_t)y * dst_stride;
+      for (int x = 0; x < dst_width; x++) {
+        int x0 = 2 * x;
+        int x1 = std::min(x0 + 1, width - 1);
+        // rounded, so repeated halving doesn't drift darker
+        out[x].r = (uint8_t)((row0[x0].r + row0[x1].r + row1[x0].r + row1[x1].r + 2) / 4);
+        out[x].g = (uint8_t)((row0[x0].g + row0[x1].g + row1[x0].g + row1[x1].g + 2) / 4);
+        out[x].b = (uint8_t)((row0[x0].b + row0[x1].b + row1[x0].b + row1[x1].b + 2) / 4);
+      }
+    }
+  });
+}
@@ -0,0 +1,52 @@
+#ifndef _CONVERT_H_
+#define _CONVERT_H_
+
+#include <cstddef>
+#include <cstdint>
+
+struct RGB;
+
+// Source layouts that can be converted into Capture's RGB pixels.
+enum class PixelFormat {
+  BGRX32, // X11 ZPixmap / GDI DIB, byte order B G R X
+  XRGB32, // big endian X11 ZPixmap, byte order X R G B
+  RGBA32,
+  RGB24,
+  BGR24,
+  GRAY8,
+  GRAYA8,
+};
+
+int pixel_format_bytes(PixelFormat format);
+
+// The instruction sets the row kernels use. The best one the CPU supports is
+// picked on first use.
+enum class ConvertLevel {
+  Scalar,
+  SSSE3,
+  AVX2,
+};
+
+// Limits the kernels to level, e.g. to test them against the scalar code.
+// Returns the level used from now on, lower when the CPU lacks level. Not
+// thread safe, call it while nothing converts.
+ConvertLevel convert_set_level(ConvertLevel level);
+
+// Converts a width x height block of src into dst. src_pitch is the distance in
+// bytes between two source rows and may be negative for bottom-up images,
+// dst_stride is the distance in pixels between two destination rows.
+// Rows are split into bands and converted on up to max_threads threads,
+// 0 meaning one per core. The threads are kept between calls.
+void convert_to_rgb(PixelFormat format, const uint8_t* src, ptrdiff_t src_pitch, RGB* dst, int dst_stride, int width, int height, int max_threads = 0);
+
+// The other way around, converts RGB pixels into a four byte format, e.g. a
+// locked texture. Only BGRX32 and RGBA32 are supported, X and A are set to
+// 255. src_stride is in pixels, dst_pitch in bytes.
+void convert_from_rgb(PixelFormat format, const RGB* src, int src_stride, uint8_t* dst, ptrdiff_t dst_pitch, int width, int height, int max_threads = 0);
+
+// Halves a width x height block of src into dst by averaging each 2x2 block
+// of pixels. dst is (width + 1) / 2 x (height + 1) / 2, odd sizes repeat the
+// last column or row. Strides are in pixels, threads as above.
+void downsample_rgb(const RGB* src, int src_stride, RGB* dst, int dst_stride, int width, int height, int max_threads = 0);
+
+#endif
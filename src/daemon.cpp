@@ -0,0 +1,415 @@
+#include "daemon.h"
+#include "cappyClient.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if !_WIN32
+  #include <csignal>
+  #include <cstring>
+  #include <fcntl.h>
+  #include <poll.h>
+  #include <sys/socket.h>
+  #include <sys/stat.h>
+  #include <sys/time.h>
+  #include <sys/un.h>
+  #include <unistd.h>
+#endif
+
+#ifndef MSG_NOSIGNAL
+  #define MSG_NOSIGNAL 0
+#endif
+
+// a client that started a request but doesn't send the rest, or doesn't read
+// the reply, within this time is dropped, so it can't hold up everybody else.
+static constexpr int request_timeout_ms = 1000;
+// for finding out whether another daemon is running
+static constexpr int probe_timeout_ms = 500;
+static constexpr size_t max_clients     = 16;
+// holds the points and answers of the largest CAPPY_OP_PIXELS request
+static constexpr size_t buffer_size = cappy_max_points * (sizeof(CappyPoint) + sizeof(CappyPixel));
+
+#if !_WIN32
+// written by the SIGUSR1 handler and by stop() to wake the server thread
+static int wake_pipe[2] = {-1, -1};
+
+static void on_signal(int) {
+  char byte       = 1;
+  ssize_t ignored = write(wake_pipe[1], &byte, 1);
+  (void)ignored;
+}
+
+static bool write_all(int fd, const void* data, size_t size) {
+  const uint8_t* p = (const uint8_t*)data;
+  while (size > 0) {
+    ssize_t written = send(fd, p, size, MSG_NOSIGNAL);
+    if (written <= 0) return false;
+    p += written;
+    size -= written;
+  }
+  return true;
+}
+
+static bool read_all(int fd, void* data, size_t size) {
+  uint8_t* p = (uint8_t*)data;
+  while (size > 0) {
+    pollfd pfd = {fd, POLLIN, 0};
+    if (poll(&pfd, 1, request_timeout_ms) <= 0) return false;
+
+    ssize_t got = read(fd, p, size);
+    if (got <= 0) return false;
+    p += got;
+    size -= got;
+  }
+  return true;
+}
+
+static bool reply(int fd, uint32_t status, uint32_t size = 0) {
+  CappyReply header = {status, size};
+  return write_all(fd, &header, sizeof(header));
+}
+
+// Skips the payload of a request that is answered without reading it.
+static bool skip(int fd, uint32_t size, std::vector<uint8_t>& buffer) {
+  while (size > 0) {
+    uint32_t n = std::min<uint32_t>(size, buffer.size());
+    if (!read_all(fd, buffer.data(), n)) return false;
+    size -= n;
+  }
+  return true;
+}
+#endif
+
+DaemonServer::~DaemonServer() {
+  stop();
+}
+
+bool DaemonServer::listen(Capture& c, std::mutex& lock, Uint32 show, Uint32 capture_request) {
+  stop();
+
+#if _WIN32
+  SDL_Log("Daemon mode is not supported on this platform!");
+  return false;
+#else
+  capture       = &c;
+  capture_lock  = &lock;
+  show_event    = show;
+  capture_event = capture_request;
+  path          = cappy_socket_path();
+
+  // the directory keeps everybody else away from the socket from the moment
+  // it is bound
+  if (!cappy_socket_dir_private(path, true)) {
+    SDL_Log("Only the user may have access to the directory of the daemon socket: '%s'", path.c_str());
+    return false;
+  }
+
+  CappyClient running;
+  if (running.connect(path, probe_timeout_ms)) {
+    SDL_Log("Another cappy daemon is already listening on '%s'", path.c_str());
+    return false;
+  }
+  // nobody answers, the socket was left behind by a daemon that died
+  unlink(path.c_str());
+
+  sockaddr_un address;
+  std::memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address.sun_path)) {
+    SDL_Log("Daemon socket path is too long: '%s'", path.c_str());
+    return false;
+  }
+  std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+  listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listen_fd < 0 || bind(listen_fd, (sockaddr*)&address, sizeof(address)) < 0 || ::listen(listen_fd, 8) < 0) {
+    SDL_Log("Failed to listen on '%s': %s", path.c_str(), strerror(errno));
+    if (listen_fd >= 0) close(listen_fd);
+    listen_fd = -1;
+    return false;
+  }
+  // only the user running the daemon may talk to it, besides the directory
+  chmod(path.c_str(), 0600);
+
+  if (pipe(wake_pipe) < 0) {
+    close(listen_fd);
+    listen_fd = -1;
+    unlink(path.c_str());
+    return false;
+  }
+  fcntl(wake_pipe[0], F_SETFL, O_NONBLOCK);
+  fcntl(wake_pipe[1], F_SETFL, O_NONBLOCK);
+
+  struct sigaction action;
+  std::memset(&action, 0, sizeof(action));
+  action.sa_handler = on_signal;
+  action.sa_flags   = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGUSR1, &action, nullptr);
+
+  buffer.resize(buffer_size);
+  stopping = false;
+  thread   = std::thread(&DaemonServer::run, this);
+  return true;
+#endif
+}
+
+void DaemonServer::stop() {
+#if !_WIN32
+  if (!thread.joinable()) return;
+
+  signal(SIGUSR1, SIG_DFL);
+  {
+    std::lock_guard<std::mutex> lock(capture_mutex);
+    stopping = true;
+  }
+  capture_done.notify_all();
+  on_signal(0);
+  thread.join();
+
+  for (int client : clients) close(client);
+  clients.clear();
+  close(listen_fd);
+  close(wake_pipe[0]);
+  close(wake_pipe[1]);
+  listen_fd = wake_pipe[0] = wake_pipe[1] = -1;
+  unlink(path.c_str());
+#endif
+}
+
+void DaemonServer::finish_capture(bool ok) {
+  {
+    std::lock_guard<std::mutex> lock(capture_mutex);
+    capture_result = ok ? 1 : 2;
+  }
+  capture_done.notify_all();
+}
+
+void DaemonServer::push_event(Uint32 type) {
+  SDL_Event event;
+  SDL_memset(&event, 0, sizeof(event));
+  event.type = type;
+  SDL_PushEvent(&event);
+}
+
+void DaemonServer::run() {
+#if !_WIN32
+  std::vector<pollfd> fds;
+
+  while (!stopping) {
+    fds.clear();
+    fds.push_back({listen_fd, POLLIN, 0});
+    fds.push_back({wake_pipe[0], POLLIN, 0});
+    for (int client : clients) fds.push_back({client, POLLIN, 0});
+
+    if (poll(fds.data(), fds.size(), -1) < 0) {
+      if (errno == EINTR) continue;
+      break;
+    }
+
+    if (fds[1].revents & POLLIN) {
+      char bytes[16];
+      while (read(wake_pipe[0], bytes, sizeof(bytes)) > 0) {
+      }
+      if (stopping) break;
+      push_event(show_event);
+    }
+
+    // served before accepting, clients is reordered below
+    for (size_t i = fds.size() - 1; i >= 2; i--) {
+      if (!fds[i].revents) continue;
+      if (!(fds[i].revents & POLLIN) || !serve(fds[i].fd)) {
+        close(fds[i].fd);
+        clients.erase(clients.begin() + (i - 2));
+      }
+    }
+
+    if (fds[0].revents & POLLIN) {
+      int client = accept(listen_fd, nullptr, nullptr);
+      if (client < 0) continue;
+      timeval timeout = {request_timeout_ms / 1000, request_timeout_ms % 1000 * 1000};
+      if (clients.size() >= max_clients || setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) < 0) {
+        close(client);
+        continue;
+      }
+      clients.push_back(client);
+    }
+  }
+#endif
+}
+
+// Answers one request, false drops the client.
+bool DaemonServer::serve(int client) {
+#if _WIN32
+  return false;
+#else
+  CappyRequest request;
+  if (!read_all(client, &request, sizeof(request))) return false;
+  if (request.size > cappy_max_request_size) return false;
+
+  switch (request.op) {
+    case CAPPY_OP_SHOW: {
+      if (!skip(client, request.size, buffer)) return false;
+      push_event(show_event);
+      return reply(client, CAPPY_OK);
+    }
+    case CAPPY_OP_CAPTURE:
+    case CAPPY_OP_INFO: {
+      if (!skip(client, request.size, buffer)) return false;
+      return serve_capture(client, request.op);
+    }
+    case CAPPY_OP_PIXELS: {
+      if (request.size % sizeof(CappyPoint) != 0) return skip(client, request.size, buffer) && reply(client, CAPPY_BAD_REQUEST);
+      return serve_pixels(client, request.size);
+    }
+    case CAPPY_OP_REGION:
+    case CAPPY_OP_STATS: {
+      CappyRect rect;
+      if (request.size != sizeof(rect)) return skip(client, request.size, buffer) && reply(client, CAPPY_BAD_REQUEST);
+      if (!read_all(client, &rect, sizeof(rect))) return false;
+      if (rect.width < 0 || rect.height < 0) return reply(client, CAPPY_BAD_REQUEST);
+      return request.op == CAPPY_OP_REGION ? serve_region(client, rect) : serve_stats(client, rect);
+    }
+    default:
+      return skip(client, request.size, buffer) && reply(client, CAPPY_BAD_REQUEST);
+  }
+#endif
+}
+
+bool DaemonServer::serve_capture(int client, uint32_t op) {
+#if _WIN32
+  return false;
+#else
+  if (op == CAPPY_OP_CAPTURE) {
+    // grabbing hides the window and uploads textures, the main thread does it
+    std::unique_lock<std::mutex> lock(capture_mutex);
+    capture_result = 0;
+    push_event(capture_event);
+    capture_done.wait(lock, [&]() { return capture_result != 0 || stopping; });
+    if (capture_result != 1) return reply(client, CAPPY_FAILED);
+  }
+
+  CappyCaptureInfo info = {};
+  {
+    std::lock_guard<std::mutex> lock(*capture_lock);
+    if (!capture->captured) return reply(client, CAPPY_NO_CAPTURE);
+    info.width        = capture->width;
+    info.height       = capture->height;
+    info.region_count = (uint32_t)capture->regions.size();
+  }
+  return reply(client, CAPPY_OK, sizeof(info)) && write_all(client, &info, sizeof(info));
+#endif
+}
+
+bool DaemonServer::serve_pixels(int client, uint32_t size) {
+#if _WIN32
+  return false;
+#else
+  size_t count       = size / sizeof(CappyPoint);
+  CappyPoint* points = (CappyPoint*)buffer.data();
+  CappyPixel* out    = (CappyPixel*)(buffer.data() + (size_t)cappy_max_points * sizeof(CappyPoint));
+  if (!read_all(client, points, size)) return false;
+
+  {
+    std::lock_guard<std::mutex> lock(*capture_lock);
+    if (!capture->captured) return reply(client, CAPPY_NO_CAPTURE);
+
+    for (size_t i = 0; i < count; i++) {
+      RGB rgb;
+      if (capture->at(points[i].x, points[i].y, rgb)) {
+        out[i] = {rgb.r, rgb.g, rgb.b, 255};
+      } else {
+        out[i] = {0, 0, 0, 0};
+      }
+    }
+  }
+
+  return reply(client, CAPPY_OK, (uint32_t)(count * sizeof(CappyPixel))) && write_all(client, out, count * sizeof(CappyPixel));
+#endif
+}
+
+bool DaemonServer::serve_region(int client, const CappyRect& rect) {
+#if _WIN32
+  return false;
+#else
+  uint64_t size = (uint64_t)rect.width * rect.height * sizeof(RGB);
+  if (size > UINT32_MAX) return reply(client, CAPPY_BAD_REQUEST);
+
+  {
+    std::lock_guard<std::mutex> lock(*capture_lock);
+    if (!capture->captured) return reply(client, CAPPY_NO_CAPTURE);
+  }
+  if (!reply(client, CAPPY_OK, (uint32_t)size)) return false;
+  if (size == 0) return true;
+
+  // a row must fit, the buffer only ever grows
+  size_t row_bytes = (size_t)rect.width * sizeof(RGB);
+  if (buffer.size() < row_bytes) buffer.resize(row_bytes);
+  int rows_per_chunk = (int)(buffer.size() / row_bytes);
+
+  for (int y = 0; y < rect.height; y += rows_per_chunk) {
+    int rows = std::min(rows_per_chunk, rect.height - y);
+    {
+      std::lock_guard<std::mutex> lock(*capture_lock);
+      capture->read(rect.x, rect.y + y, rect.width, rows, (RGB*)buffer.data(), rect.width, {0, 0, 0});
+    }
+    if (!write_all(client, buffer.data(), rows * row_bytes)) return false;
+  }
+  return true;
+#endif
+}
+
+bool DaemonServer::serve_stats(int client, const CappyRect& rect) {
+#if _WIN32
+  return false;
+#else
+  CappyStats stats = {};
+  uint64_t sum[3]  = {0, 0, 0};
+  uint64_t sum2[3] = {0, 0, 0};
+  stats.min[0] = stats.min[1] = stats.min[2] = 255;
+
+  {
+    std::lock_guard<std::mutex> lock(*capture_lock);
+    if (!capture->captured) return reply(client, CAPPY_NO_CAPTURE);
+
+    // region by region, the gaps between them don't count. Rows are read
+    // rather than taken from pixels, raw captures have none.
+    for (const CaptureRegion& region : capture->regions) {
+      int x1 = std::max(rect.x, region.x);
+      int y1 = std::max(rect.y, region.y);
+      int x2 = std::min((int64_t)rect.x + rect.width, (int64_t)region.x + region.width);
+      int y2 = std::min((int64_t)rect.y + rect.height, (int64_t)region.y + region.height);
+      if (x2 <= x1 || y2 <= y1) continue;
+
+      size_t row_bytes = (size_t)(x2 - x1) * sizeof(RGB);
+      if (buffer.size() < row_bytes) buffer.resize(row_bytes);
+      const RGB* row = (const RGB*)buffer.data();
+
+      for (int y = y1; y < y2; y++) {
+        capture->read(x1, y, x2 - x1, 1, (RGB*)buffer.data(), x2 - x1, {0, 0, 0});
+        for (int x = 0; x < x2 - x1; x++) {
+          const uint8_t c[3] = {row[x].r, row[x].g, row[x].b};
+          for (int i = 0; i < 3; i++) {
+            sum[i] += c[i];
+            sum2[i] += (uint32_t)c[i] * c[i];
+            stats.min[i] = std::min(stats.min[i], c[i]);
+            stats.max[i] = std::max(stats.max[i], c[i]);
+          }
+        }
+      }
+      stats.pixels += (uint64_t)(x2 - x1) * (y2 - y1);
+    }
+  }
+
+  if (stats.pixels == 0) {
+    stats.min[0] = stats.min[1] = stats.min[2] = 0;
+  } else {
+    for (int i = 0; i < 3; i++) {
+      double mean     = (double)sum[i] / stats.pixels;
+      stats.mean[i]   = mean;
+      stats.stddev[i] = std::sqrt(std::max(0.0, (double)sum2[i] / stats.pixels - mean * mean));
+    }
+  }
+  return reply(client, CAPPY_OK, sizeof(stats)) && write_all(client, &stats, sizeof(stats));
+#endif
+}
@@ -0,0 +1,63 @@
+#ifndef _DAEMON_H_
+#define _DAEMON_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "SDL3/SDL.h"
+
+#include "capture.h"
+#include "cappyProtocol.h"
+
+// The socket API of a resident cappy (cappy --daemon), see cappyProtocol.h.
+// A thread serves the connected clients. Pixel queries are answered right
+// there from Capture::pixels while holding capture_lock, which the main
+// thread holds whenever it changes the capture. Requests that need the main
+// thread are handed over as SDL events, so the main loop can sleep in
+// SDL_WaitEvent while the window is hidden:
+//   show_event     show requests and SIGUSR1
+//   capture_event  capture requests, answer them with finish_capture
+// Only available on POSIX systems.
+class DaemonServer {
+public:
+  ~DaemonServer();
+
+  bool listen(Capture& capture, std::mutex& capture_lock, Uint32 show_event, Uint32 capture_event);
+  void stop();
+
+  // Completes the pending capture request.
+  void finish_capture(bool ok);
+
+private:
+  void run();
+  bool serve(int client);
+  bool serve_pixels(int client, uint32_t size);
+  bool serve_region(int client, const CappyRect& rect);
+  bool serve_stats(int client, const CappyRect& rect);
+  bool serve_capture(int client, uint32_t op);
+  void push_event(Uint32 type);
+
+  Capture* capture         = nullptr;
+  std::mutex* capture_lock = nullptr;
+  Uint32 show_event        = 0;
+  Uint32 capture_event     = 0;
+
+  std::thread thread;
+  std::atomic<bool> stopping = false;
+  int listen_fd              = -1;
+  std::vector<int> clients;
+  std::string path;
+
+  // reused by every request, so answering needs no allocations
+  std::vector<uint8_t> buffer;
+
+  std::mutex capture_mutex;
+  std::condition_variable capture_done;
+  int capture_result = 0; // 0 while pending, 1 done, 2 failed
+};
+
+#endif
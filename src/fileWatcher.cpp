@@ -0,0 +1,67 @@
+#include "fileWatcher.h"
+
+#include <algorithm>
+
+#if __linux__
+  #include <climits>
+  #include <fcntl.h>
+  #include <sys/inotify.h>
+  #include <unistd.h>
+#endif
+
+FileWatcher::~FileWatcher() {
+  stop();
+}
+
+bool FileWatcher::is_running() const {
+  return fd >= 0;
+}
+
+bool FileWatcher::start(const std::string& path) {
+  stop();
+
+#if __linux__
+  size_t slash    = path.find_last_of('/');
+  std::string dir = slash == std::string::npos ? "." : path.substr(0, std::max<size_t>(slash, 1));
+  name            = slash == std::string::npos ? path : path.substr(slash + 1);
+
+  fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd < 0) return false;
+
+  // close_write instead of modify, so a file that is still being written is
+  // not read half way.
+  if (inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+    stop();
+    return false;
+  }
+  return true;
+#else
+  (void)path;
+  return false;
+#endif
+}
+
+void FileWatcher::stop() {
+#if __linux__
+  if (fd >= 0) close(fd);
+#endif
+  fd = -1;
+}
+
+bool FileWatcher::poll() {
+  if (fd < 0) return false;
+
+  bool changed = false;
+#if __linux__
+  alignas(inotify_event) char buffer[16 * (sizeof(inotify_event) + NAME_MAX + 1)];
+  ssize_t size;
+  while ((size = read(fd, buffer, sizeof(buffer))) > 0) {
+    for (char* p = buffer; p < buffer + size;) {
+      const inotify_event* event = (const inotify_event*)p;
+      if (event->len > 0 && name == event->name) changed = true;
+      p += sizeof(inotify_event) + event->len;
+    }
+  }
+#endif
+  return changed;
+}
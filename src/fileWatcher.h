@@ -0,0 +1,31 @@
+#ifndef _FILE_WATCHER_H_
+#define _FILE_WATCHER_H_
+
+#include <string>
+
+// Reports when a file was written again, e.g. an image that is exported over
+// and over. The directory is watched rather than the file itself, so files
+// that are replaced by renaming a new one over them keep being followed.
+// Only available on Linux (inotify).
+class FileWatcher {
+public:
+  FileWatcher() = default;
+  ~FileWatcher();
+
+  FileWatcher(const FileWatcher&)            = delete;
+  FileWatcher& operator=(const FileWatcher&) = delete;
+
+  bool start(const std::string& path);
+  void stop();
+  bool is_running() const;
+
+  // Never blocks. Returns true when the file was written or replaced since
+  // the last call.
+  bool poll();
+
+private:
+  int fd = -1;
+  std::string name;
+};
+
+#endif
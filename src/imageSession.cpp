@@ -0,0 +1,197 @@
+#include "imageSession.h"
+
+#include <algorithm>
+
+// textures are 4 bytes per pixel in every format but the RGB24 fallback,
+// their mips for zooming out add up to another third
+static constexpr size_t texture_bytes = 4;
+
+static size_t texture_memory(size_t texels) {
+  return texels * texture_bytes * 4 / 3;
+}
+
+static size_t capture_texels(const Capture& capture) {
+  size_t texels = 0;
+  for (const CaptureRegion& region : capture.regions) {
+    texels += (size_t)region.width * region.height;
+  }
+  return texels;
+}
+
+static size_t capture_memory(const Capture& capture) {
+  // tiled captures are mapped, the system pages them in and out
+  if (capture.is_tiled()) return 0;
+  if (capture.is_compact()) return capture.store.size() + capture.low_bits.size() * sizeof(RGB);
+  if (capture.is_raw()) return capture.raw_size();
+  return capture_texels(capture) * sizeof(RGB) + capture.low_bits.size() * sizeof(RGB);
+}
+
+ImageSession::~ImageSession() {
+  stop();
+}
+
+void ImageSession::start(size_t memory_budget, size_t texture_budget) {
+  stop();
+
+  this->memory_budget  = memory_budget;
+  this->texture_budget = texture_budget;
+
+  // decoding is mostly inflating PNGs, a few threads keep up with switching
+  // through the images without taking over the machine.
+  unsigned count = std::clamp(std::thread::hardware_concurrency() / 2, 1u, 4u);
+  stopping       = false;
+  for (unsigned i = 0; i < count; i++) {
+    threads.emplace_back(&ImageSession::run, this);
+  }
+}
+
+void ImageSession::stop() {
+  {
+    std::lock_guard<std::mutex> guard(mutex);
+    stopping = true;
+    queue.clear();
+  }
+  wake.notify_all();
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  threads.clear();
+}
+
+size_t ImageSession::add(const CaptureOptions& options, std::unique_ptr<Capture> capture) {
+  SessionImage image;
+  image.options = options;
+  if (capture) {
+    image.memory = capture_memory(*capture);
+    image.texels = capture_texels(*capture);
+  }
+  image.capture = std::move(capture);
+  images.push_back(std::move(image));
+  return images.size() - 1;
+}
+
+void ImageSession::request(size_t index) {
+  SessionImage& image = images[index];
+  if (image.is_resident() || image.decoding || !image.can_decode()) return;
+
+  image.decoding = true;
+  image.failed   = false;
+  {
+    std::lock_guard<std::mutex> guard(mutex);
+    queue.push_back({index, image.options, false});
+  }
+  wake.notify_one();
+}
+
+void ImageSession::reload(size_t index) {
+  SessionImage& image = images[index];
+  if (!image.can_decode()) return;
+  // one reload at a time, a save during it is picked up by another one
+  if (image.reloading) {
+    image.reload_again = true;
+    return;
+  }
+
+  image.reloading = true;
+  {
+    std::lock_guard<std::mutex> guard(mutex);
+    queue.push_back({index, image.options, true});
+  }
+  wake.notify_one();
+}
+
+bool ImageSession::take_reload(size_t& index, std::unique_ptr<Capture>& capture) {
+  if (reloaded.empty()) return false;
+  index   = reloaded.front().index;
+  capture = std::move(reloaded.front().capture);
+  reloaded.pop_front();
+  return true;
+}
+
+bool ImageSession::poll() {
+  std::vector<Decoded> done;
+  {
+    std::lock_guard<std::mutex> guard(mutex);
+    done.swap(decoded);
+  }
+
+  for (Decoded& d : done) {
+    SessionImage& image = images[d.index];
+    if (d.reload) {
+      image.reloading = false;
+      if (image.reload_again) {
+        image.reload_again = false;
+        reload(d.index);
+      }
+      reloaded.push_back(std::move(d));
+      continue;
+    }
+
+    image.decoding = false;
+    if (!d.capture) {
+      image.failed = true;
+    } else if (!image.is_resident()) {
+      image.memory  = capture_memory(*d.capture);
+      image.texels  = capture_texels(*d.capture);
+      image.capture = std::move(d.capture);
+    }
+  }
+  return !done.empty();
+}
+
+void ImageSession::use(size_t index, const Capture& shown) {
+  SessionImage& image = images[index];
+  image.memory        = capture_memory(shown);
+  image.texels        = capture_texels(shown);
+  image.last_used     = ++clock;
+}
+
+void ImageSession::trim(size_t active) {
+  size_t memory = 0;
+  // the active image's textures are in the machine, they always count
+  size_t textures_used = texture_memory(images[active].texels);
+  std::vector<size_t> order;
+  for (size_t i = 0; i < images.size(); i++) {
+    if (images[i].is_resident()) memory += images[i].memory;
+    if (i == active) continue;
+    if (!images[i].textures.empty()) textures_used += texture_memory(images[i].texels);
+    order.push_back(i);
+  }
+
+  std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return images[a].last_used < images[b].last_used; });
+
+  for (size_t i : order) {
+    if (memory <= memory_budget && textures_used <= texture_budget) break;
+
+    SessionImage& image = images[i];
+    bool drop_pixels    = memory > memory_budget && image.is_resident() && image.can_decode();
+    // textures are of no use without their pixels, they go along with them
+    if ((textures_used > texture_budget || drop_pixels) && !image.textures.empty()) {
+      image.textures.clear();
+      textures_used -= texture_memory(image.texels);
+    }
+    if (drop_pixels) {
+      image.capture.reset();
+      memory -= image.memory;
+    }
+  }
+}
+
+void ImageSession::run() {
+  while (true) {
+    Job job;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      wake.wait(lock, [&]() { return stopping || !queue.empty(); });
+      if (stopping) return;
+      job = std::move(queue.front());
+      queue.pop_front();
+    }
+
+    auto capture = std::make_unique<Capture>();
+    if (!capture->capture(job.options)) capture.reset();
+
+    std::lock_guard<std::mutex> guard(mutex);
+    decoded.push_back({job.index, std::move(capture), job.reload});
+  }
+}
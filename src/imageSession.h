@@ -0,0 +1,124 @@
+#ifndef _IMAGE_SESSION_H_
+#define _IMAGE_SESSION_H_
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "SDL3/SDL.h"
+
+#include "capture.h"
+#include "cappyMachine.h"
+
+// One image of a session. Images opened from a file are decoded again after
+// they were evicted, screen captures can't be and always stay in memory.
+struct SessionImage {
+  CaptureOptions options;
+  // the decoded pixels, null while evicted or decoding. The shown image's
+  // pixels are in the main capture, this then holds an empty capture to
+  // swap with.
+  std::unique_ptr<Capture> capture;
+  // the uploaded textures, empty while evicted. The shown image's textures
+  // are in the machine.
+  std::vector<CaptureTexture> textures;
+
+  size_t memory     = 0; // bytes of pixels while decoded
+  size_t texels     = 0; // pixels of all textures
+  Uint64 last_used  = 0;
+  bool decoding     = false;
+  bool failed       = false;
+  bool reloading    = false;
+  bool reload_again = false; // saved again while reloading
+
+  // the view when the image was left, restored when it is shown again
+  bool has_view       = false;
+  SDL_FPoint position = {0.0f, 0.0f};
+  float scale         = 1.0f;
+  SDL_Rect crop       = {0, 0, 0, 0};
+
+  bool is_resident() const {
+    return capture != nullptr;
+  }
+
+  bool can_decode() const {
+    return !options.file.empty();
+  }
+};
+
+// Many images open at once, e.g. a dozen screenshots to compare. Files are
+// decoded by a pool of threads. The images used most recently keep their
+// pixels within memory_budget and their textures within texture_budget, the
+// others are evicted and decoded or uploaded again when they are shown.
+class ImageSession {
+public:
+  ~ImageSession();
+
+  void start(size_t memory_budget, size_t texture_budget);
+  void stop();
+
+  // Adds an image, capture holds its pixels when they are already loaded.
+  size_t add(const CaptureOptions& options, std::unique_ptr<Capture> capture);
+
+  size_t size() const {
+    return images.size();
+  }
+
+  SessionImage& get(size_t index) {
+    return images[index];
+  }
+
+  // Queues decoding image index unless it is resident or already queued.
+  void request(size_t index);
+
+  // Moves finished decodes into their images. Returns true when any arrived.
+  bool poll();
+
+  // Decodes image index's file again on the pool, e.g. after it was saved
+  // again. The result doesn't replace the image's pixels but is handed out
+  // by take_reload, so the shown image can be updated from it.
+  void reload(size_t index);
+
+  // A reload poll found finished, false when there is none. capture is null
+  // when the file couldn't be decoded.
+  bool take_reload(size_t& index, std::unique_ptr<Capture>& capture);
+
+  // Marks image index, whose pixels are in shown, as the one on screen.
+  void use(size_t index, const Capture& shown);
+
+  // Evicts the least recently used images until both budgets hold. The image
+  // on screen is never evicted.
+  void trim(size_t active);
+
+private:
+  struct Job {
+    size_t index;
+    CaptureOptions options;
+    bool reload;
+  };
+
+  struct Decoded {
+    size_t index;
+    std::unique_ptr<Capture> capture;
+    bool reload;
+  };
+
+  void run();
+
+  std::vector<SessionImage> images;
+  size_t memory_budget  = 0;
+  size_t texture_budget = 0;
+  Uint64 clock          = 0;
+
+  std::vector<std::thread> threads;
+  std::mutex mutex;
+  std::condition_variable wake;
+  bool stopping = false;
+  std::deque<Job> queue;
+  std::vector<Decoded> decoded;
+  std::deque<Decoded> reloaded; // by poll, for take_reload
+};
+
+#endif
@@ -0,0 +1,330 @@
+#include "liveCapture.h"
+
+#if __linux__
+  #include "x11Grab.h"
+  #include <X11/extensions/Xcomposite.h>
+  #include <X11/extensions/Xdamage.h>
+  #include <X11/extensions/Xfixes.h>
+  #include <algorithm>
+#endif
+
+#if __linux__
+// A top level window below cappy's own, with damage tracking of its own as
+// the screen doesn't show it.
+struct LiveCaptureWindow {
+  Window window;
+  XWindowAttributes attr;
+  Damage damage;
+  bool damaged;
+};
+
+struct LiveCaptureConnection {
+  Display* display = nullptr;
+  Window root;
+  XWindowAttributes attr;
+  XShmSegmentInfo shminfo;
+  bool use_shm          = false;
+  Damage damage         = 0;
+  XserverRegion parts   = 0;
+  int damage_event_base = 0;
+
+  // Top level windows keep their contents off-screen, either because a
+  // compositing manager redirects them or because live mode asked the server
+  // to. redirected is true in the latter case.
+  bool readable   = false;
+  bool redirected = false;
+
+  // the windows below cappy's own, bottom first, rebuilt whenever windows
+  // are mapped, moved or restacked
+  std::vector<LiveCaptureWindow> below;
+  bool stack_changed = true;
+  Window own_window  = 0;
+  SDL_Rect covered   = {0, 0, 0, 0}; // by cappy's window, empty when unmapped
+};
+#else
+struct LiveCaptureConnection {};
+#endif
+
+// Splits a minus b into up to 4 rectangles, returns how many were written.
+static int subtract_rect(const SDL_Rect& a, const SDL_Rect& b, SDL_Rect* out) {
+  SDL_Rect overlap;
+  if (!SDL_GetRectIntersection(&a, &b, &overlap)) {
+    out[0] = a;
+    return 1;
+  }
+
+  int count = 0;
+  if (overlap.y > a.y) out[count++] = {a.x, a.y, a.w, overlap.y - a.y};
+  if (overlap.y + overlap.h < a.y + a.h) out[count++] = {a.x, overlap.y + overlap.h, a.w, a.y + a.h - overlap.y - overlap.h};
+  if (overlap.x > a.x) out[count++] = {a.x, overlap.y, overlap.x - a.x, overlap.h};
+  if (overlap.x + overlap.w < a.x + a.w) out[count++] = {overlap.x + overlap.w, overlap.y, a.x + a.w - overlap.x - overlap.w, overlap.h};
+  return count;
+}
+
+#if __linux__
+// The rectangle of a window on the screen, border included.
+static SDL_Rect window_rect(const XWindowAttributes& attr) {
+  return {attr.x, attr.y, attr.width + 2 * attr.border_width, attr.height + 2 * attr.border_width};
+}
+
+static void forget_below(LiveCaptureConnection& c) {
+  for (const LiveCaptureWindow& below : c.below) {
+    XDamageDestroy(c.display, below.damage);
+  }
+  c.below.clear();
+}
+
+// Finds where cappy's top level window covers the screen and, when their
+// contents can be read, the windows below it that overlap it.
+static void restack(LiveCaptureConnection& c) {
+  forget_below(c);
+  c.covered = {0, 0, 0, 0};
+  if (!c.own_window) return;
+
+  Window root, parent, top = c.own_window;
+  Window* children;
+  unsigned int count;
+  for (;;) {
+    if (!XQueryTree(c.display, top, &root, &parent, &children, &count)) return;
+    if (children) XFree(children);
+    if (parent == root || parent == None) break;
+    top = parent;
+  }
+
+  XWindowAttributes attr;
+  if (!XGetWindowAttributes(c.display, top, &attr) || attr.map_state != IsViewable) return;
+  c.covered = window_rect(attr);
+  if (!c.readable) return;
+
+  // children are listed bottom first
+  if (!XQueryTree(c.display, c.root, &root, &parent, &children, &count)) return;
+  for (unsigned int i = 0; i < count && children[i] != top; i++) {
+    LiveCaptureWindow below = {children[i]};
+    if (!XGetWindowAttributes(c.display, below.window, &below.attr) || below.attr.map_state != IsViewable || below.attr.c_class != InputOutput) continue;
+
+    SDL_Rect rect = window_rect(below.attr);
+    if (!SDL_HasRectIntersection(&rect, &c.covered)) continue;
+
+    below.damage  = XDamageCreate(c.display, below.window, XDamageReportNonEmpty);
+    below.damaged = false;
+    c.below.push_back(below);
+  }
+  if (children) XFree(children);
+}
+
+// Paints area, which cappy's window covers, from the windows below it,
+// bottom first. What no window covers stays black, the root window's own
+// background can't be read.
+static bool grab_below(LiveCaptureConnection& c, const SDL_Rect& area, RGB* dst, int dst_stride) {
+  for (int y = 0; y < area.h; y++) {
+    std::fill_n(dst + (size_t)y * dst_stride, area.w, RGB{0, 0, 0});
+  }
+
+  bool ok = true;
+  for (const LiveCaptureWindow& below : c.below) {
+    SDL_Rect rect = window_rect(below.attr);
+    SDL_Rect part;
+    if (!SDL_GetRectIntersection(&area, &rect, &part)) continue;
+
+    // the shared memory segment is sized for the root window's depth
+    XShmSegmentInfo* shminfo = c.use_shm && below.attr.depth == c.attr.depth ? &c.shminfo : nullptr;
+    Pixmap pixmap            = XCompositeNameWindowPixmap(c.display, below.window);
+    RGB* part_dst            = dst + (size_t)(part.y - area.y) * dst_stride + (part.x - area.x);
+    ok                       = grab_rect(c.display, pixmap, below.attr, shminfo, part.x - rect.x, part.y - rect.y, part.w, part.h, part_dst, dst_stride, 0) && ok;
+    XFreePixmap(c.display, pixmap);
+  }
+  return ok;
+}
+#endif
+
+LiveCapture::LiveCapture() {
+}
+
+LiveCapture::~LiveCapture() {
+  stop();
+}
+
+bool LiveCapture::is_running() const {
+  return connection != nullptr;
+}
+
+bool LiveCapture::start(const Capture& capture) {
+  stop();
+
+#if __linux__
+  // damage is tracked on the root window, only screen captures share its
+  // coordinates.
+  if (!capture.is_screen()) return false;
+
+  auto c     = std::make_unique<LiveCaptureConnection>();
+  c->display = XOpenDisplay(NULL);
+  if (!c->display) return false;
+
+  c->root = DefaultRootWindow(c->display);
+
+  int error_base, major, minor;
+  if (!XGetWindowAttributes(c->display, c->root, &c->attr) ||
+      !XFixesQueryExtension(c->display, &error_base, &error_base) || !XFixesQueryVersion(c->display, &major, &minor) ||
+      !XDamageQueryExtension(c->display, &c->damage_event_base, &error_base) || !XDamageQueryVersion(c->display, &major, &minor)) {
+    XCloseDisplay(c->display);
+    return false;
+  }
+
+  XErrorHandler old_handler = XSetErrorHandler(x11_error_handler);
+  c->use_shm                = xshm_attach(c->display, c->attr, capture.regions, c->shminfo);
+
+  // Automatic redirection keeps every top level window in a pixmap of its
+  // own while the server still draws them as usual. A compositing manager
+  // already redirects them and refuses a second redirection.
+  int composite_major = 0, composite_minor = 2;
+  if (XCompositeQueryExtension(c->display, &error_base, &error_base) && XCompositeQueryVersion(c->display, &composite_major, &composite_minor) && (composite_major > 0 || composite_minor >= 2)) {
+    Atom manager = XInternAtom(c->display, ("_NET_WM_CM_S" + std::to_string(DefaultScreen(c->display))).c_str(), False);
+    if (XGetSelectionOwner(c->display, manager) != None) {
+      c->readable = true;
+    } else {
+      x11_error_reset();
+      XCompositeRedirectSubwindows(c->display, c->root, CompositeRedirectAutomatic);
+      XSync(c->display, False);
+      c->redirected = !x11_error_reset();
+      c->readable   = c->redirected;
+    }
+  }
+  XSetErrorHandler(old_handler);
+
+  // windows being mapped, moved or restacked change what is below cappy
+  XSelectInput(c->display, c->root, SubstructureNotifyMask);
+
+  // NonEmpty sends one event until the damage is subtracted again, the
+  // rectangles are then fetched in one go in poll.
+  c->damage = XDamageCreate(c->display, c->root, XDamageReportNonEmpty);
+  c->parts  = XFixesCreateRegion(c->display, nullptr, 0);
+
+  connection = std::move(c);
+  return true;
+#else
+  return false;
+#endif
+}
+
+void LiveCapture::stop() {
+  if (!connection) return;
+
+#if __linux__
+  LiveCaptureConnection& c = *connection;
+  XErrorHandler old_handler = XSetErrorHandler(x11_error_handler);
+  forget_below(c);
+  if (c.redirected) XCompositeUnredirectSubwindows(c.display, c.root, CompositeRedirectAutomatic);
+  XFixesDestroyRegion(c.display, c.parts);
+  XDamageDestroy(c.display, c.damage);
+  if (c.use_shm) xshm_detach(c.display, c.shminfo);
+  XSync(c.display, False);
+  XSetErrorHandler(old_handler);
+  XCloseDisplay(c.display);
+#endif
+
+  connection.reset();
+}
+
+bool LiveCapture::poll(Capture& capture, unsigned long own_window, std::vector<SDL_Rect>& updated) {
+  if (!connection) return false;
+
+#if __linux__
+  LiveCaptureConnection& c = *connection;
+
+  bool damaged = false;
+  while (XPending(c.display)) {
+    XEvent event;
+    XNextEvent(c.display, &event);
+    if (event.type == c.damage_event_base + XDamageNotify) {
+      Damage damage = ((XDamageNotifyEvent&)event).damage;
+      if (damage == c.damage) damaged = true;
+      for (LiveCaptureWindow& below : c.below) {
+        if (below.damage == damage) below.damaged = true;
+      }
+    } else if (event.type == ConfigureNotify || event.type == MapNotify || event.type == UnmapNotify || event.type == DestroyNotify || event.type == CirculateNotify || event.type == ReparentNotify) {
+      c.stack_changed = true;
+    }
+  }
+  if (own_window != c.own_window) {
+    c.own_window    = own_window;
+    c.stack_changed = true;
+  }
+  if (!damaged && !c.stack_changed && std::none_of(c.below.begin(), c.below.end(), [](const LiveCaptureWindow& below) { return below.damaged; })) {
+    return true;
+  }
+
+  // windows vanish between the requests, their errors are expected
+  XErrorHandler old_handler = XSetErrorHandler(x11_error_handler);
+
+  // what to grab from the screen and what to rebuild below cappy's window
+  std::vector<SDL_Rect> dirty;
+  SDL_Rect under = {0, 0, 0, 0};
+
+  if (c.stack_changed) {
+    // what was below cappy's window before is on the screen again
+    if (!SDL_RectEmpty(&c.covered)) dirty.push_back(c.covered);
+    restack(c);
+    c.stack_changed = false;
+    if (c.readable) under = c.covered;
+  }
+
+  if (damaged) {
+    XDamageSubtract(c.display, c.damage, None, c.parts);
+    int count         = 0;
+    XRectangle* rects = XFixesFetchRegion(c.display, c.parts, &count);
+    for (int i = 0; i < count; i++) {
+      dirty.push_back({rects[i].x, rects[i].y, rects[i].width, rects[i].height});
+    }
+    if (rects) XFree(rects);
+  }
+
+  for (LiveCaptureWindow& below : c.below) {
+    if (!below.damaged) continue;
+    XDamageSubtract(c.display, below.damage, None, None);
+    below.damaged = false;
+
+    SDL_Rect rect = window_rect(below.attr);
+    SDL_Rect part;
+    if (SDL_GetRectIntersection(&rect, &c.covered, &part)) {
+      SDL_GetRectUnion(&under, &part, &under);
+    }
+  }
+
+  bool ok = true;
+  for (const CaptureRegion& region : capture.regions) {
+    SDL_Rect bounds = {region.x, region.y, region.width, region.height};
+    SDL_Rect area;
+
+    // the screen shows cappy where it covers, that part comes from below
+    for (const SDL_Rect& damage : dirty) {
+      if (!SDL_GetRectIntersection(&damage, &bounds, &area)) continue;
+
+      SDL_Rect pieces[4];
+      int piece_count = subtract_rect(area, c.covered, pieces);
+      for (int p = 0; p < piece_count; p++) {
+        const SDL_Rect& piece = pieces[p];
+        RGB* dst              = capture.pixels + region.offset + (size_t)(piece.y - region.y) * region.width + (piece.x - region.x);
+        if (grab_rect(c.display, c.root, c.attr, c.use_shm ? &c.shminfo : nullptr, piece.x, piece.y, piece.w, piece.h, dst, region.width, 0)) {
+          updated.push_back(piece);
+        } else {
+          ok = false;
+        }
+      }
+    }
+
+    if (SDL_GetRectIntersection(&under, &bounds, &area)) {
+      RGB* dst = capture.pixels + region.offset + (size_t)(area.y - region.y) * region.width + (area.x - region.x);
+      ok       = grab_below(c, area, dst, region.width) && ok;
+      updated.push_back(area);
+    }
+  }
+
+  XSync(c.display, False);
+  x11_error_reset();
+  XSetErrorHandler(old_handler);
+
+  return ok;
+#else
+  return false;
+#endif
+}
@@ -0,0 +1,35 @@
+#ifndef _LIVE_CAPTURE_H_
+#define _LIVE_CAPTURE_H_
+
+#include <memory>
+#include <vector>
+
+#include "SDL3/SDL.h"
+
+#include "capture.h"
+
+struct LiveCaptureConnection;
+
+// Keeps a capture up to date by re-grabbing only the parts of the screen that
+// XDamage reports as changed. Only available on X11 for screen captures.
+class LiveCapture {
+public:
+  LiveCapture();
+  ~LiveCapture();
+
+  bool start(const Capture& capture);
+  void stop();
+  bool is_running() const;
+
+  // Re-grabs everything damaged since the last call into capture.pixels and
+  // appends the updated rectangles (world coordinates) to updated.
+  // own_window is cappy's own X window, 0 if unknown. Where it is mapped the
+  // screen shows cappy itself, so that part is rebuilt from the off-screen
+  // pixmaps of the windows below it. Without XComposite it is left as it is.
+  bool poll(Capture& capture, unsigned long own_window, std::vector<SDL_Rect>& updated);
+
+private:
+  std::unique_ptr<LiveCaptureConnection> connection;
+};
+
+#endif
@@ -1,12 +1,40 @@
 #include "cappyMachine.h"
 #include "renderer.h"
 
+#include <algorithm>
 #include <cmath>
+#include <cstring>
 #include <format>
 
-CappyMachine::CappyMachine(cappyConfig& config, std::shared_ptr<SDL_Renderer> r, Capture& c, std::shared_ptr<SDL_Texture> t, CameraSmooth& cam, TTF_Font* f) : config(config), renderer(r), capture(c), texture(t), camera(cam), font(f) {
+CappyMachine::CappyMachine(cappyConfig& config, std::shared_ptr<SDL_Renderer> r, Capture& c, CameraSmooth& cam, TTF_Font* f) : config(config), renderer(r), capture(c), camera(cam), font(f) {
   current_w = c.width;
   current_h = c.height;
+
+  SDL_RendererInfo info;
+  if (SDL_GetRendererInfo(renderer.get(), &info) != 0) return;
+
+  // 0 when the driver doesn't say, the default is then kept
+  if (info.max_texture_width > 0) max_texture_w = info.max_texture_width;
+  if (info.max_texture_height > 0) max_texture_h = info.max_texture_height;
+
+  // Most renderers have no 24 bit texture format, SDL then converts every
+  // RGB24 update into a temporary buffer before handing it to the driver.
+  // Writing the renderer's own format into the locked texture skips that.
+  if (SDL_BYTEORDER == SDL_LIL_ENDIAN) {
+    for (Uint32 i = 0; i < info.num_texture_formats; i++) {
+      SDL_PixelFormatEnum format = (SDL_PixelFormatEnum)info.texture_formats[i];
+      if (format == SDL_PIXELFORMAT_XRGB8888 || format == SDL_PIXELFORMAT_ARGB8888) {
+        texture_format = format;
+        texture_layout = PixelFormat::BGRX32;
+        break;
+      }
+      if (format == SDL_PIXELFORMAT_XBGR8888 || format == SDL_PIXELFORMAT_ABGR8888) {
+        texture_format = format;
+        texture_layout = PixelFormat::RGBA32;
+        break;
+      }
+    }
+  }
 }
 
 Capture& CappyMachine::get_capture() {
@@ -21,8 +49,12 @@ CameraSmooth& CappyMachine::get_camera() {
   return camera;
 }
 
-std::shared_ptr<SDL_Texture>& CappyMachine::get_texture() {
-  return texture;
+std::vector<CaptureTexture>& CappyMachine::get_textures() {
+  return textures;
+}
+
+Recorder& CappyMachine::get_recorder() {
+  return recorder;
 }
 
 TTF_Font* CappyMachine::get_font() {
@@ -33,6 +65,397 @@ const cappyConfig& CappyMachine::get_config() {
   return config;
 }
 
+// Creates a texture for every capture region, or a grid of them for regions
+// larger than the renderer's texture size limit, e.g. 5K monitors on drivers
+// limited to 4096 or tall scroll captures. Textures from an earlier capture
+// are reused when their size did not change, so recapturing the same screen
+// layout creates no new textures. The textures are streaming so live mode
+// can cheaply update parts of them.
+//
+// Capture::pixels stays around after the upload, ColorState, saving, the
+// recorder and live mode all read or write it. Once it is left alone it is
+// compressed, see compact_capture. Raw captures are uploaded from their raw
+// pixels and get no RGB copy for it.
+bool CappyMachine::prepare_textures() {
+  tile_textures.clear();
+  cancel_compact();
+
+  // tiled captures upload only the tiles render_tiled needs
+  if (capture.is_tiled()) {
+    textures.clear();
+    pending.clear();
+    return true;
+  }
+
+  // uploading reads the pixels row by row
+  if (!capture.is_raw()) capture.expand();
+
+  std::vector<CaptureTexture> prepared;
+  prepared.reserve(capture.regions.size());
+  pending.clear();
+
+  // multiples of the upload tiles, so no tile straddles two textures
+  int chunk_w = std::max(upload_tile_size, max_texture_w / upload_tile_size * upload_tile_size);
+  int chunk_h = std::max(upload_tile_size, max_texture_h / upload_tile_size * upload_tile_size);
+
+  for (size_t i = 0; i < capture.regions.size(); i++) {
+    const CaptureRegion& region = capture.regions[i];
+    for (int y = 0; y < region.height; y += chunk_h) {
+      for (int x = 0; x < region.width; x += chunk_w) {
+        SDL_Rect rect = {region.x + x, region.y + y, std::min(chunk_w, region.width - x), std::min(chunk_h, region.height - y)};
+
+        size_t n = prepared.size();
+        std::shared_ptr<SDL_Texture> texture;
+        std::vector<std::shared_ptr<SDL_Texture>> mips;
+        if (n < textures.size() && textures[n].rect.w == rect.w && textures[n].rect.h == rect.h) {
+          texture = textures[n].texture;
+          mips    = std::move(textures[n].mips);
+        } else {
+          texture = std::shared_ptr<SDL_Texture>(SDL_CreateTexture(renderer.get(), texture_format, SDL_TEXTUREACCESS_STREAMING, rect.w, rect.h), SDL_DestroyTexture);
+          if (!texture) return false;
+          SDL_SetTextureScaleMode(texture.get(), SDL_SCALEMODE_NEAREST);
+          // the alpha of ARGB8888 is always 255, blending it would only cost time
+          SDL_SetTextureBlendMode(texture.get(), SDL_BLENDMODE_NONE);
+        }
+
+        prepared.push_back({rect, i, texture, nullptr, {}, std::move(mips), {0, 0, rect.w, rect.h}});
+      }
+    }
+  }
+
+  textures = std::move(prepared);
+  return true;
+}
+
+// Uploads every capture region into its textures before returning.
+bool CappyMachine::upload_capture() {
+  if (!prepare_textures()) return false;
+
+  for (const CaptureTexture& t : textures) {
+    if (!upload_capture_rect(t, {0, 0, t.rect.w, t.rect.h})) return false;
+  }
+  return true;
+}
+
+// Starts uploading the capture in tiles, the tiles closest to focus (world
+// coordinates, usually the cursor) first. Every region first gets a preview
+// texture sampling only every preview_step-th pixel, so something can be
+// drawn right away. continue_upload then uploads tiles until the frame's
+// time budget is used up.
+bool CappyMachine::start_upload(float focus_x, float focus_y) {
+  if (!prepare_textures()) return false;
+
+  std::vector<RGB> samples;
+  for (size_t i = 0; i < textures.size(); i++) {
+    CaptureTexture& t = textures[i];
+
+    int preview_w = (t.rect.w + preview_step - 1) / preview_step;
+    int preview_h = (t.rect.h + preview_step - 1) / preview_step;
+    samples.resize((size_t)preview_w * preview_h);
+    for (int y = 0; y < preview_h; y++) {
+      RGB* out = samples.data() + (size_t)y * preview_w;
+      if (capture.is_raw()) {
+        // the sampled pixels of the row are converted as a column of one
+        // pixel wide rows, preview_step pixels apart
+        const CaptureRegion& region = capture.regions[t.region];
+        int bytes                   = pixel_format_bytes(capture.raw_format);
+        ptrdiff_t pitch;
+        const uint8_t* row = capture.raw_rows(t.region, pitch) + (t.rect.y - region.y + y * preview_step) * pitch + (size_t)(t.rect.x - region.x) * bytes;
+        convert_to_rgb(capture.raw_format, row, (ptrdiff_t)preview_step * bytes, out, 1, 1, preview_w, 1);
+        continue;
+      }
+      const RGB* row = texture_pixels(t, 0, y * preview_step);
+      for (int x = 0; x < preview_w; x++) {
+        out[x] = row[x * preview_step];
+      }
+    }
+
+    t.preview = std::shared_ptr<SDL_Texture>(SDL_CreateTexture(renderer.get(), texture_format, SDL_TEXTUREACCESS_STREAMING, preview_w, preview_h), SDL_DestroyTexture);
+    if (!t.preview) return false;
+    SDL_SetTextureScaleMode(t.preview.get(), SDL_SCALEMODE_LINEAR);
+    SDL_SetTextureBlendMode(t.preview.get(), SDL_BLENDMODE_NONE);
+    if (!upload_rect(t.preview.get(), {0, 0, preview_w, preview_h}, samples.data(), preview_w)) return false;
+
+    int tiles_x = (t.rect.w + upload_tile_size - 1) / upload_tile_size;
+    int tiles_y = (t.rect.h + upload_tile_size - 1) / upload_tile_size;
+    t.ready.assign((size_t)tiles_x * tiles_y, 0);
+    for (int ty = 0; ty < tiles_y; ty++) {
+      for (int tx = 0; tx < tiles_x; tx++) {
+        SDL_Rect local = {tx * upload_tile_size, ty * upload_tile_size, std::min(upload_tile_size, t.rect.w - tx * upload_tile_size), std::min(upload_tile_size, t.rect.h - ty * upload_tile_size)};
+        pending.push_back({i, (size_t)ty * tiles_x + tx, local});
+      }
+    }
+  }
+
+  auto distance = [&](const PendingTile& p) {
+    const SDL_Rect& rect = textures[p.texture].rect;
+    float dx             = rect.x + p.local.x + p.local.w * 0.5f - focus_x;
+    float dy             = rect.y + p.local.y + p.local.h * 0.5f - focus_y;
+    return dx * dx + dy * dy;
+  };
+  std::sort(pending.begin(), pending.end(), [&](const PendingTile& a, const PendingTile& b) { return distance(a) > distance(b); });
+
+  return true;
+}
+
+// Uploads pending tiles for up to upload_budget_ns, at least one per call.
+bool CappyMachine::continue_upload() {
+  Uint64 start = SDL_GetTicksNS();
+  do {
+    if (pending.empty()) break;
+
+    PendingTile p = pending.back();
+    pending.pop_back();
+
+    CaptureTexture& t = textures[p.texture];
+    if (!upload_capture_rect(t, p.local)) {
+      pending.clear();
+      return false;
+    }
+    t.ready[p.tile] = 1;
+  } while (SDL_GetTicksNS() - start < upload_budget_ns);
+
+  if (pending.empty()) {
+    for (CaptureTexture& t : textures) {
+      t.preview.reset();
+      t.ready.clear();
+    }
+  }
+  return true;
+}
+
+bool CappyMachine::is_uploading() const {
+  return !pending.empty();
+}
+
+// Exchanges the textures with ones kept for another capture, e.g. another
+// image of the session. Textures that are still being uploaded are dropped
+// rather than handed out half filled.
+void CappyMachine::swap_textures(std::vector<CaptureTexture>& other) {
+  if (is_uploading()) {
+    pending.clear();
+    textures.clear();
+  }
+  std::swap(textures, other);
+  tile_textures.clear();
+  cancel_compact();
+}
+
+// Writes pixels into the local rectangle of texture, stride is in pixels.
+bool CappyMachine::upload_rect(SDL_Texture* texture, const SDL_Rect& local, const RGB* pixels, int stride) {
+  if (texture_layout == PixelFormat::RGB24) {
+    return SDL_UpdateTexture(texture, &local, pixels, stride * 3) == 0;
+  }
+
+  // the locked memory is write only, every pixel of local gets written
+  void* locked;
+  int pitch;
+  if (SDL_LockTexture(texture, &local, &locked, &pitch) < 0) return false;
+  convert_from_rgb(texture_layout, pixels, stride, (uint8_t*)locked, pitch, local.w, local.h);
+  SDL_UnlockTexture(texture);
+  return true;
+}
+
+// Writes the local rectangle of texture t from the capture. Raw pixels in the
+// texture's layout are copied row by row, other raw layouts are converted in
+// bands.
+bool CappyMachine::upload_capture_rect(const CaptureTexture& t, const SDL_Rect& local) {
+  if (!capture.is_raw()) return upload_rect(t.texture.get(), local, texture_pixels(t, local.x, local.y), capture.regions[t.region].width);
+
+  const CaptureRegion& region = capture.regions[t.region];
+  int x                       = t.rect.x + local.x;
+  int y                       = t.rect.y + local.y;
+
+  if (capture.raw_format == texture_layout && texture_layout != PixelFormat::RGB24) {
+    ptrdiff_t src_pitch;
+    const uint8_t* src = capture.raw_rows(t.region, src_pitch) + (y - region.y) * src_pitch + (size_t)(x - region.x) * 4;
+
+    void* locked;
+    int pitch;
+    if (SDL_LockTexture(t.texture.get(), &local, &locked, &pitch) < 0) return false;
+    for (int row = 0; row < local.h; row++) {
+      std::memcpy((uint8_t*)locked + (size_t)row * pitch, src + row * src_pitch, (size_t)local.w * 4);
+    }
+    SDL_UnlockTexture(t.texture.get());
+    return true;
+  }
+
+  int band_rows = std::max(1, 65536 / local.w);
+  for (int row = 0; row < local.h; row += band_rows) {
+    int h = std::min(band_rows, local.h - row);
+    upload_band.resize((size_t)local.w * h);
+    capture.read(x, y + row, local.w, h, upload_band.data(), local.w, {0, 0, 0});
+    if (!upload_rect(t.texture.get(), {local.x, local.y + row, local.w, h}, upload_band.data(), local.w)) return false;
+  }
+  return true;
+}
+
+// The capture's pixel at x, y of texture t, its rows are the region's width
+// apart.
+const RGB* CappyMachine::texture_pixels(const CaptureTexture& t, int x, int y) const {
+  const CaptureRegion& region = capture.regions[t.region];
+  return capture.pixels + region.offset + (size_t)(t.rect.y - region.y + y) * region.width + (t.rect.x - region.x + x);
+}
+
+// Brings the mips of t up to date with the capture. Only the stale area is
+// halved, level by level on all cores, and uploaded. It is widened to whole
+// pixels of the smallest mip so every level covers it exactly. With max_rows
+// only that many rows of it are done, the rest stays stale.
+bool CappyMachine::update_mips(CaptureTexture& t, int max_rows) {
+  if (SDL_RectEmpty(&t.mips_stale)) return true;
+
+  if (t.mips.empty()) {
+    for (int level = 1; level <= mip_levels; level++) {
+      int w = (t.rect.w + (1 << level) - 1) >> level;
+      int h = (t.rect.h + (1 << level) - 1) >> level;
+      std::shared_ptr<SDL_Texture> mip(SDL_CreateTexture(renderer.get(), texture_format, SDL_TEXTUREACCESS_STREAMING, w, h), SDL_DestroyTexture);
+      if (!mip) {
+        t.mips.clear();
+        return false;
+      }
+      // drawn at 1-2 screen pixels per pixel, blending those is smoother
+      SDL_SetTextureScaleMode(mip.get(), SDL_SCALEMODE_LINEAR);
+      SDL_SetTextureBlendMode(mip.get(), SDL_BLENDMODE_NONE);
+      t.mips.push_back(mip);
+    }
+  }
+
+  int align = 1 << mip_levels;
+  int x1    = t.mips_stale.x / align * align;
+  int y1    = t.mips_stale.y / align * align;
+  int x2    = std::min(t.rect.w, (t.mips_stale.x + t.mips_stale.w + align - 1) / align * align);
+  int y2    = std::min(t.rect.h, (t.mips_stale.y + t.mips_stale.h + align - 1) / align * align);
+
+  SDL_Rect rest = {0, 0, 0, 0};
+  if (y2 - y1 > max_rows) {
+    y2   = y1 + std::max(align, max_rows / align * align);
+    rest = {t.mips_stale.x, y2, t.mips_stale.w, t.mips_stale.y + t.mips_stale.h - y2};
+  }
+
+  int w = x2 - x1;
+  int h = y2 - y1;
+
+  // raw captures are converted for the stale area only
+  std::vector<RGB> converted;
+  const RGB* src;
+  int stride;
+  if (capture.is_raw()) {
+    converted.resize((size_t)w * h);
+    capture.read(t.rect.x + x1, t.rect.y + y1, w, h, converted.data(), w, {0, 0, 0});
+    src    = converted.data();
+    stride = w;
+  } else {
+    capture.expand();
+    src    = texture_pixels(t, x1, y1);
+    stride = capture.regions[t.region].width;
+  }
+  std::vector<RGB> halves[mip_levels];
+  for (int level = 1; level <= mip_levels; level++) {
+    std::vector<RGB>& half = halves[level - 1];
+    int half_w             = (w + 1) / 2;
+    int half_h             = (h + 1) / 2;
+    half.resize((size_t)half_w * half_h);
+    downsample_rgb(src, stride, half.data(), half_w, w, h);
+    if (!upload_rect(t.mips[level - 1].get(), {x1 >> level, y1 >> level, half_w, half_h}, half.data(), half_w)) return false;
+
+    src    = half.data();
+    stride = half_w;
+    w      = half_w;
+    h      = half_h;
+  }
+
+  t.mips_stale = rest;
+  return true;
+}
+
+// Compresses the capture's pixels once all of them are in textures, see
+// Capture::compact. Each call takes a step of about compact_budget_ns, so a
+// large capture doesn't stall a frame. The mips are brought up to date first
+// as they are made from the pixels, then the pixels are compressed a few
+// tiles at a time. Uploading the capture again, updating it or switching to
+// another one starts over. Returns true once the capture is compact.
+bool CappyMachine::compact_capture() {
+  if (capture.is_tiled() || !capture.can_compact() || is_uploading() || (compacting && compacting != capture.pixels)) {
+    cancel_compact();
+    return false;
+  }
+
+  Uint64 start    = SDL_GetTicksNS();
+  compact_pending = true;
+  if (!compacting) {
+    for (CaptureTexture& t : textures) {
+      while (!SDL_RectEmpty(&t.mips_stale)) {
+        if (!update_mips(t, compact_mip_rows)) {
+          cancel_compact();
+          return false;
+        }
+        if (SDL_GetTicksNS() - start >= compact_budget_ns) return false;
+      }
+    }
+
+    capture.expand();
+    compressed.begin(capture.regions);
+    compacting = capture.pixels;
+  }
+
+  while (compressed.compress_next(capture.pixels, compact_tiles)) {
+    if (SDL_GetTicksNS() - start >= compact_budget_ns) return false;
+  }
+
+  bool compact = capture.compact(compressed);
+  cancel_compact();
+  return compact;
+}
+
+// true while compact_capture has steps left
+bool CappyMachine::is_compacting() const {
+  return compact_pending;
+}
+
+void CappyMachine::cancel_compact() {
+  compact_pending = false;
+  compacting      = nullptr;
+  compressed.clear();
+}
+
+// Re-uploads only the given rectangles (world coordinates) of the capture,
+// e.g. the areas live mode grabbed again.
+void CappyMachine::update_capture(const std::vector<SDL_Rect>& rects) {
+  if (!rects.empty()) cancel_compact();
+
+  // the tiles of every level over the rectangles are uploaded again when
+  // they are drawn, the others still show the same pixels
+  if (capture.is_tiled()) {
+    for (auto it = tile_textures.begin(); it != tile_textures.end();) {
+      int level     = (int)(it->first >> 48);
+      int size      = TilePyramid::tile_size << level;
+      SDL_Rect tile = {(int)(it->first & 0xffffff) * size, (int)(it->first >> 24 & 0xffffff) * size, size, size};
+      bool stale    = std::any_of(rects.begin(), rects.end(), [&](const SDL_Rect& rect) { return SDL_HasRectIntersection(&rect, &tile); });
+      it            = stale ? tile_textures.erase(it) : std::next(it);
+    }
+    return;
+  }
+
+  for (const SDL_Rect& rect : rects) {
+    for (CaptureTexture& t : textures) {
+      if (t.region >= capture.regions.size()) continue;
+
+      SDL_Rect area;
+      if (!SDL_GetRectIntersection(&rect, &t.rect, &area)) continue;
+
+      SDL_Rect local = {area.x - t.rect.x, area.y - t.rect.y, area.w, area.h};
+      upload_capture_rect(t, local);
+
+      // the mips catch up when they are drawn, not on every live frame
+      if (SDL_RectEmpty(&t.mips_stale)) {
+        t.mips_stale = local;
+      } else {
+        SDL_GetRectUnion(&t.mips_stale, &local, &t.mips_stale);
+      }
+    }
+  }
+}
+
 void CappyMachine::zoom(bool zoom_in, float mousex, float mousey) {
   float scale = camera.get_scale();
   if (zoom_in) {
@@ -40,17 +463,183 @@ void CappyMachine::zoom(bool zoom_in, float mousex, float mousey) {
       camera.smooth_zoom(zoom_in_factor, mousex, mousey, zoom_in_ms);
     }
   } else {
-    if (scale >= min_scale) {
+    // tiled captures can be zoomed out until they fit into one tile
+    float min = min_scale;
+    if (capture.is_tiled()) min = std::min(min_scale, (float)TilePyramid::tile_size / std::max(capture.width, capture.height));
+    if (scale >= min) {
       camera.smooth_zoom(-1.0f * zoom_out_factor, mousex, mousey, zoom_out_ms);
     }
   }
 }
 
+// Draws the world area x1,y1 - x2,y2 from src (texture coordinates) of texture.
+void CappyMachine::render_texture_area(SDL_Texture* texture, const SDL_FRect& src, int x1, int y1, int x2, int y2) {
+  SDL_FPoint pos = camera.world_to_screen(x1, y1);
+  SDL_FRect dst  = {pos.x, pos.y, (float)(x2 - x1) * camera.get_scale(), (float)(y2 - y1) * camera.get_scale()};
+  SDL_RenderTexture(renderer.get(), texture, &src, &dst);
+}
+
 void CappyMachine::render_capture() {
-  SDL_FPoint pos = camera.world_to_screen(current_x, current_y);
-  SDL_FRect r1   = {(float)current_x, (float)current_y, (float)current_w, (float)current_h};
-  SDL_FRect r2   = {pos.x, pos.y, (float)current_w * camera.get_scale(), (float)current_h * camera.get_scale()};
-  SDL_RenderTexture(renderer.get(), texture.get(), &r1, &r2);
+  if (capture.is_tiled()) {
+    render_tiled();
+    return;
+  }
+
+  int vx1, vy1, vx2, vy2;
+  if (!visible_area(vx1, vy1, vx2, vy2)) return;
+
+  // Zoomed out, nearest sampling of the full texture skips pixels and fine
+  // detail shimmers while panning. The mip with about one pixel per screen
+  // pixel is drawn instead, at 1x and above the texture stays crisp. Between
+  // 1x and 0.5x the full texture is drawn filtered.
+  int level   = 0;
+  float scale = camera.get_scale();
+  while (level < mip_levels && scale * (1 << (level + 1)) <= 1.0f) {
+    level++;
+  }
+  SDL_ScaleMode scale_mode = scale < 1.0f ? SDL_SCALEMODE_LINEAR : SDL_SCALEMODE_NEAREST;
+
+  // Only the captured regions have textures, everything else inside the crop
+  // (e.g. the gaps between monitors) keeps the background from render_clear.
+  // Textures outside the window are skipped.
+  for (CaptureTexture& t : textures) {
+    int x1 = std::max(vx1, t.rect.x);
+    int y1 = std::max(vy1, t.rect.y);
+    int x2 = std::min(vx2, t.rect.x + t.rect.w);
+    int y2 = std::min(vy2, t.rect.y + t.rect.h);
+    if (x2 <= x1 || y2 <= y1) continue;
+
+    SDL_SetTextureScaleMode(t.texture.get(), scale_mode);
+    if (t.ready.empty()) {
+      SDL_Texture* texture = t.texture.get();
+      float factor         = 1.0f;
+      if (level > 0 && update_mips(t)) {
+        texture = t.mips[level - 1].get();
+        factor  = (float)(1 << level);
+      }
+      SDL_FRect src = {(x1 - t.rect.x) / factor, (y1 - t.rect.y) / factor, (x2 - x1) / factor, (y2 - y1) / factor};
+      render_texture_area(texture, src, x1, y1, x2, y2);
+      continue;
+    }
+
+    // still uploading, the preview fills in for the missing tiles
+    float step    = (float)preview_step;
+    SDL_FRect src = {(x1 - t.rect.x) / step, (y1 - t.rect.y) / step, (x2 - x1) / step, (y2 - y1) / step};
+    render_texture_area(t.preview.get(), src, x1, y1, x2, y2);
+
+    int tiles_x = (t.rect.w + upload_tile_size - 1) / upload_tile_size;
+    for (size_t tile = 0; tile < t.ready.size(); tile++) {
+      if (!t.ready[tile]) continue;
+
+      int tx1 = std::max(x1, t.rect.x + (int)(tile % tiles_x) * upload_tile_size);
+      int ty1 = std::max(y1, t.rect.y + (int)(tile / tiles_x) * upload_tile_size);
+      int tx2 = std::min(x2, t.rect.x + (int)(tile % tiles_x + 1) * upload_tile_size);
+      int ty2 = std::min(y2, t.rect.y + (int)(tile / tiles_x + 1) * upload_tile_size);
+      if (tx2 <= tx1 || ty2 <= ty1) continue;
+
+      SDL_FRect tile_src = {(float)(tx1 - t.rect.x), (float)(ty1 - t.rect.y), (float)(tx2 - tx1), (float)(ty2 - ty1)};
+      render_texture_area(t.texture.get(), tile_src, tx1, ty1, tx2, ty2);
+    }
+  }
+}
+
+// The part of the crop that is inside the window, in world coordinates.
+// Returns false when none of it is.
+bool CappyMachine::visible_area(int& x1, int& y1, int& x2, int& y2) {
+  int output_w, output_h;
+  SDL_GetCurrentRenderOutputSize(renderer.get(), &output_w, &output_h);
+  SDL_FPoint top_left     = camera.screen_to_world(0.0f, 0.0f);
+  SDL_FPoint bottom_right = camera.screen_to_world((float)output_w, (float)output_h);
+
+  x1 = std::max(current_x, (int)std::floor(top_left.x));
+  y1 = std::max(current_y, (int)std::floor(top_left.y));
+  x2 = std::min(current_x + current_w, (int)std::ceil(bottom_right.x));
+  y2 = std::min(current_y + current_h, (int)std::ceil(bottom_right.y));
+  return x2 > x1 && y2 > y1;
+}
+
+// Draws the visible tiles of the pyramid level that has about one pixel per
+// screen pixel. Tiles are uploaded when they first come into view, for as
+// long as the frame's upload budget lasts. The coarsest level, a single
+// tile, is drawn underneath so tiles that are not uploaded yet show blurred
+// instead of missing.
+void CappyMachine::render_tiled() {
+  const TilePyramid& pyramid = capture.pyramid;
+  Uint64 start               = SDL_GetTicksNS();
+  frame++;
+
+  int levels  = pyramid.get_levels();
+  int level   = 0;
+  float scale = camera.get_scale();
+  while (level + 1 < levels && scale * (1 << (level + 1)) <= 1.0f) {
+    level++;
+  }
+
+  int x1, y1, x2, y2;
+  if (!visible_area(x1, y1, x2, y2)) return;
+
+  if (level + 1 < levels) render_tiled_level(levels - 1, x1, y1, x2, y2, start);
+  render_tiled_level(level, x1, y1, x2, y2, start);
+}
+
+// Tiles are drawn filtered whenever they are scaled down, as in
+// render_capture.
+void CappyMachine::render_tiled_level(int level, int x1, int y1, int x2, int y2, Uint64 start) {
+  const TilePyramid& pyramid = capture.pyramid;
+  int factor                 = 1 << level;
+  int world_tile             = TilePyramid::tile_size * factor;
+  SDL_ScaleMode scale_mode   = camera.get_scale() * factor < 1.0f ? SDL_SCALEMODE_LINEAR : SDL_SCALEMODE_NEAREST;
+
+  for (int ty = y1 / world_tile; ty <= (y2 - 1) / world_tile; ty++) {
+    for (int tx = x1 / world_tile; tx <= (x2 - 1) / world_tile; tx++) {
+      SDL_Texture* texture = tile_texture(level, tx, ty, start);
+      if (!texture) continue;
+      SDL_SetTextureScaleMode(texture, scale_mode);
+
+      int wx  = tx * world_tile;
+      int wy  = ty * world_tile;
+      int tx1 = std::max(x1, wx);
+      int ty1 = std::max(y1, wy);
+      int tx2 = std::min(x2, wx + pyramid.tile_width(level, tx) * factor);
+      int ty2 = std::min(y2, wy + pyramid.tile_height(level, ty) * factor);
+      if (tx2 <= tx1 || ty2 <= ty1) continue;
+
+      SDL_FRect src = {(float)(tx1 - wx) / factor, (float)(ty1 - wy) / factor, (float)(tx2 - tx1) / factor, (float)(ty2 - ty1) / factor};
+      render_texture_area(texture, src, tx1, ty1, tx2, ty2);
+    }
+  }
+}
+
+// The texture of a pyramid tile, uploaded on first use. Returns null when
+// the frame's upload budget is used up, the coarsest level is always
+// uploaded. The least recently drawn tile makes room for new ones.
+SDL_Texture* CappyMachine::tile_texture(int level, int tx, int ty, Uint64 start) {
+  const TilePyramid& pyramid = capture.pyramid;
+
+  uint64_t key = (uint64_t)level << 48 | (uint64_t)ty << 24 | (uint64_t)tx;
+  auto it      = tile_textures.find(key);
+  if (it != tile_textures.end()) {
+    it->second.last_used = frame;
+    return it->second.texture.get();
+  }
+
+  if (level + 1 < pyramid.get_levels() && SDL_GetTicksNS() - start >= upload_budget_ns) return nullptr;
+
+  if (tile_textures.size() >= max_tile_textures) {
+    auto oldest = std::min_element(tile_textures.begin(), tile_textures.end(), [](const auto& a, const auto& b) { return a.second.last_used < b.second.last_used; });
+    tile_textures.erase(oldest);
+  }
+
+  int w = pyramid.tile_width(level, tx);
+  int h = pyramid.tile_height(level, ty);
+  std::shared_ptr<SDL_Texture> texture(SDL_CreateTexture(renderer.get(), texture_format, SDL_TEXTUREACCESS_STREAMING, w, h), SDL_DestroyTexture);
+  if (!texture) return nullptr;
+  SDL_SetTextureScaleMode(texture.get(), SDL_SCALEMODE_NEAREST);
+  SDL_SetTextureBlendMode(texture.get(), SDL_BLENDMODE_NONE);
+  if (!upload_rect(texture.get(), {0, 0, w, h}, pyramid.tile(level, tx, ty), w)) return nullptr;
+
+  tile_textures[key] = {texture, frame};
+  return texture.get();
 }
 
 void CappyMachine::render_clear(uint8_t r, uint8_t g, uint8_t b) {
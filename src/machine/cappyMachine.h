@@ -1,24 +1,56 @@
 #ifndef _CAPPY_MACHINE_H
 #define _CAPPY_MACHINE_H
 
+#include <climits>
+#include <unordered_map>
+
 #include "machine.h"
+#include "recorder.h"
+
+// A texture holding the pixels of one capture region, or of a part of it when
+// the region is larger than the renderer's texture size limit. It is placed
+// at rect in world coordinates. While a progressive upload is running, ready
+// flags the tiles of texture that arrived and preview is drawn everywhere
+// else.
+struct CaptureTexture {
+  SDL_Rect rect;
+  size_t region;
+  std::shared_ptr<SDL_Texture> texture;
+  std::shared_ptr<SDL_Texture> preview;
+  std::vector<char> ready;
+  // texture halved again and again for drawing zoomed out, mips[0] is half
+  // its size. They are built when first drawn, mips_stale is the part of
+  // texture (local coordinates) they don't show yet.
+  std::vector<std::shared_ptr<SDL_Texture>> mips;
+  SDL_Rect mips_stale;
+};
 
 enum class StateType {
   MoveState,
   ColorState,
   FlashlightState,
   DrawCropState,
+  TimelineState,
 };
 
 class CappyMachine : public Machine<CappyMachine, StateType> {
 public:
-  CappyMachine(cappyConfig& config, std::shared_ptr<SDL_Renderer> r, Capture& c, std::shared_ptr<SDL_Texture> t, CameraSmooth& cam, TTF_Font* f);
+  CappyMachine(cappyConfig& config, std::shared_ptr<SDL_Renderer> r, Capture& c, CameraSmooth& cam, TTF_Font* f);
   Capture& get_capture();
   std::shared_ptr<SDL_Renderer>& get_renderer();
   CameraSmooth& get_camera();
-  std::shared_ptr<SDL_Texture>& get_texture();
+  std::vector<CaptureTexture>& get_textures();
+  Recorder& get_recorder();
   TTF_Font* get_font();
   const cappyConfig& get_config();
+  bool upload_capture();
+  bool start_upload(float focus_x, float focus_y);
+  bool continue_upload();
+  bool is_uploading() const;
+  void swap_textures(std::vector<CaptureTexture>& other);
+  bool compact_capture();
+  bool is_compacting() const;
+  void update_capture(const std::vector<SDL_Rect>& rects);
   void zoom(bool zoom_in, float mousex, float mousey);
   void render_capture();
   void render_clear(uint8_t r, uint8_t g, uint8_t b);
@@ -41,8 +73,8 @@ public:
     grid_enabled = !grid_enabled;
   }
 
-  static std::shared_ptr<CappyMachine> make(cappyConfig& config, std::shared_ptr<SDL_Renderer> r, Capture& c, std::shared_ptr<SDL_Texture> t, CameraSmooth& cam, TTF_Font* f) {
-    return std::make_shared<CappyMachine>(config, r, c, t, cam, f);
+  static std::shared_ptr<CappyMachine> make(cappyConfig& config, std::shared_ptr<SDL_Renderer> r, Capture& c, CameraSmooth& cam, TTF_Font* f) {
+    return std::make_shared<CappyMachine>(config, r, c, cam, f);
   }
 
   int current_x = 0;
@@ -51,11 +83,68 @@ public:
   int current_h = 0;
 
 private:
+  struct PendingTile {
+    size_t texture;
+    size_t tile;
+    SDL_Rect local;
+  };
+
+  struct TileTexture {
+    std::shared_ptr<SDL_Texture> texture;
+    Uint64 last_used;
+  };
+
+  static constexpr int upload_tile_size = 256;
+  // 256 MB of tiles at 4 bytes per pixel, far more than a screen shows
+  static constexpr size_t max_tile_textures = 1024;
+  static constexpr int preview_step     = 8;
+  // mips down to a quarter, enough for min_scale
+  static constexpr int mip_levels = 2;
+  // time continue_upload may spend per frame
+  static constexpr Uint64 upload_budget_ns = 6000000;
+  // time compact_capture may spend per frame, and the rows of mips or the
+  // tiles it does between looking at the clock
+  static constexpr Uint64 compact_budget_ns = 4000000;
+  static constexpr int compact_mip_rows     = 256;
+  static constexpr size_t compact_tiles     = 16;
+
+  bool prepare_textures();
+  bool upload_rect(SDL_Texture* texture, const SDL_Rect& local, const RGB* pixels, int stride);
+  bool upload_capture_rect(const CaptureTexture& t, const SDL_Rect& local);
+  void render_texture_area(SDL_Texture* texture, const SDL_FRect& src, int x1, int y1, int x2, int y2);
+  const RGB* texture_pixels(const CaptureTexture& t, int x, int y) const;
+  bool update_mips(CaptureTexture& t, int max_rows = INT_MAX);
+  void cancel_compact();
+  bool visible_area(int& x1, int& y1, int& x2, int& y2);
+  void render_tiled();
+  void render_tiled_level(int level, int x1, int y1, int x2, int y2, Uint64 start);
+  SDL_Texture* tile_texture(int level, int tx, int ty, Uint64 start);
+
   std::shared_ptr<SDL_Renderer> renderer;
   Capture& capture;
   CameraSmooth& camera;
   cappyConfig& config;
-  std::shared_ptr<SDL_Texture> texture;
+  std::vector<CaptureTexture> textures;
+  std::vector<PendingTile> pending; // nearest tile last
+  // textures of the pyramid tiles of a tiled capture, by level, row and column
+  std::unordered_map<uint64_t, TileTexture> tile_textures;
+  Uint64 frame = 0;
+  // compact_capture stopped for the frame with steps left, compacting are
+  // the pixels it compresses into compressed, null while the mips come first
+  bool compact_pending  = false;
+  const RGB* compacting = nullptr;
+  TileStore compressed;
+  // raw captures in another layout than the textures are converted through
+  // this, a band of rows at a time
+  std::vector<RGB> upload_band;
+  // the texture format the renderer takes without converting, and the layout
+  // convert_from_rgb writes it in. RGB24 falls back to SDL_UpdateTexture.
+  SDL_PixelFormatEnum texture_format = SDL_PIXELFORMAT_RGB24;
+  PixelFormat texture_layout         = PixelFormat::RGB24;
+  // the largest texture the renderer takes, bigger regions are split
+  int max_texture_w = 16384;
+  int max_texture_h = 16384;
+  Recorder recorder;
   TTF_Font* font;
 
   float zoom_in_factor  = 3.0f;
@@ -1,44 +1,147 @@
+#include <algorithm>
 #include <cmath>
+#include <cstdio>
 #include <future>
 #include <iostream>
+#include <mutex>
 #include <thread>
 
 #include "SDL3/SDL.h"
 #include "stb_image_write.h"
 
+#if __linux__
+  #include <X11/Xlib.h>
+#endif
+
 #include "cappyMachine.h"
 #include "colorState.h"
+#include "cappyClient.h"
 #include "config.h"
+#include "daemon.h"
 #include "drawCropState.h"
+#include "fileWatcher.h"
 #include "flashlightState.h"
 #include "icon.h"
+#include "imageSession.h"
+#include "liveCapture.h"
 #include "moveState.h"
+#include "timelineState.h"
 
 #define SAVE_FILE_EVENT (SDL_EVENT_USER + 1)
+#define DAEMON_SHOW_EVENT (SDL_EVENT_USER + 2)
+#define DAEMON_CAPTURE_EVENT (SDL_EVENT_USER + 3)
+
+static constexpr Uint32 recapture_hide_ms = 100;
 
-std::shared_ptr<SDL_Texture> create_capture_texture(std::shared_ptr<SDL_Renderer> renderer, Capture& capture);
+bool present_capture(SDL_Window* window, const SDL_Rect& primary_bounds, Capture& capture, const cappyConfig& config, CappyMachine& machine);
+bool grab(SDL_Window* window, Capture& capture, const CaptureOptions& options);
+bool recapture(SDL_Window* window, Capture& capture, const CaptureOptions& options, CappyMachine& machine);
+bool show_recaptured(Capture& capture, CappyMachine& machine);
+RecorderOptions recorder_options(const cappyConfig& config);
+bool parse_args(int argc, char** argv, CaptureOptions& options, std::vector<std::string>& more_files, bool& daemon_mode, bool& watch_mode);
 
 int main(int argc, char** argv) {
+#if __linux__
+  // Parallel grabs, the grab during startup and SDL all use Xlib from
+  // different threads. Xlib has to be told before its very first call.
+  XInitThreads();
+#endif
+
+  // a plain cappy hands the capture to a running daemon, which skips all of
+  // the startup below. A daemon that doesn't answer quickly is left alone
+  // and cappy starts as usual.
+  static constexpr int forward_timeout_ms = 500;
+  CappyClient client;
+  if (argc == 1 && client.connect(cappy_socket_path(), forward_timeout_ms) && client.show()) {
+    return 0;
+  }
+  client.close();
+
   Uint32 flags = 0;
   Capture capture;
 
-  if (!capture.capture()) {
-    SDL_Log("Failed to capture screen!");
+  cappyConfig config;
+  config_init(config);
+
+  CaptureOptions capture_options;
+  capture_options.parallel = config.capture_parallel;
+
+  // huge images are opened as tile pyramids cached next to the config file
+  if (config.tile_min_mpix > 0) {
+    char* pref_path                 = SDL_GetPrefPath("", "cappy");
+    capture_options.tile_cache_dir  = std::string(pref_path) + "tiles";
+    capture_options.tile_min_pixels = (size_t)config.tile_min_mpix * 1000000;
+    SDL_free(pref_path);
+  }
+
+  std::vector<std::string> more_files;
+  bool daemon_mode = false;
+  bool watch_mode  = false;
+  if (!parse_args(argc, argv, capture_options, more_files, daemon_mode, watch_mode)) {
     return 1;
   }
 
-  cappyConfig config;
-  config_init(config);
+  // a watched file is rewritten in place, which a mapping would show half
+  // written or fault on when the file shrinks
+  capture_options.copy_file = watch_mode;
+
+  // only grab the pre-crop area, the corners are clamped to the capture below
+  // once its size is known. A second corner <= 0 means the far edge.
+  int* pre_crop = config.window_pre_crop;
+  if (pre_crop[2] > 0) {
+    capture_options.area_x = std::min(pre_crop[0], pre_crop[2]);
+    capture_options.area_w = std::abs(pre_crop[2] - pre_crop[0]);
+  } else {
+    capture_options.area_x = pre_crop[0];
+  }
+  if (pre_crop[3] > 0) {
+    capture_options.area_y = std::min(pre_crop[1], pre_crop[3]);
+    capture_options.area_h = std::abs(pre_crop[3] - pre_crop[1]);
+  } else {
+    capture_options.area_y = pre_crop[1];
+  }
+
+  Uint64 start_ns = SDL_GetTicksNS();
+
+  if (capture_options.scroll && !daemon_mode) {
+    SDL_Log("Scroll the content now, capturing stops once it didn't move for %d ms", capture_options.scroll_idle_ms);
+  }
+
+  if (daemon_mode) {
+    // closing the window only hides it, the daemon keeps running
+    SDL_SetHint(SDL_HINT_QUIT_ON_LAST_WINDOW_CLOSE, "0");
+  }
 
   if (SDL_Init(SDL_INIT_VIDEO) < 0) {
     SDL_Log("Failed to init SDL!");
     return 1;
   }
 
+  // the grab needs nothing from SDL, it runs while the window and the font
+  // are set up and is only waited for before the textures are made. It starts
+  // after SDL_Init, both install X error handlers, which are process wide.
+  // Creating the window and renderer swaps them too and waits for the grab's
+  // handler to be removed, see capture_error_handler_lock. The daemon only
+  // captures when asked to.
+  Uint64 capture_ns = 0;
+  std::future<bool> capture_done;
+  if (!daemon_mode) {
+    capture_done = std::async(std::launch::async, [&]() {
+      bool ok    = capture.capture(capture_options);
+      capture_ns = SDL_GetTicksNS() - start_ns;
+      return ok;
+    });
+  }
+
   SDL_PropertiesID props = SDL_CreateProperties();
   SDL_SetStringProperty(props, SDL_PROP_WINDOW_CREATE_TITLE_STRING, "Cappy");
-  SDL_SetNumberProperty(props, SDL_PROP_WINDOW_CREATE_WIDTH_NUMBER, capture.width);
-  SDL_SetNumberProperty(props, SDL_PROP_WINDOW_CREATE_HEIGHT_NUMBER, capture.height);
+  // the window stays hidden until the grab is done so it can't end up in the
+  // capture, its size is only known then too.
+  SDL_Rect primary_bounds = {0, 0, 640, 480};
+  SDL_GetDisplayBounds(SDL_GetPrimaryDisplay(), &primary_bounds);
+  SDL_SetBooleanProperty(props, SDL_PROP_WINDOW_CREATE_HIDDEN_BOOLEAN, 1);
+  SDL_SetNumberProperty(props, SDL_PROP_WINDOW_CREATE_WIDTH_NUMBER, primary_bounds.w);
+  SDL_SetNumberProperty(props, SDL_PROP_WINDOW_CREATE_HEIGHT_NUMBER, primary_bounds.h);
   SDL_SetNumberProperty(props, SDL_PROP_WINDOW_CREATE_X_NUMBER, 0);
   SDL_SetNumberProperty(props, SDL_PROP_WINDOW_CREATE_Y_NUMBER, 0);
 
@@ -48,6 +151,7 @@ int main(int argc, char** argv) {
     SDL_SetBooleanProperty(props, SDL_PROP_WINDOW_CREATE_BORDERLESS_BOOLEAN, 1);
   }
 
+  std::unique_lock<std::mutex> handler_lock(capture_error_handler_lock());
   std::shared_ptr<SDL_Window> window = std::shared_ptr<SDL_Window>(SDL_CreateWindowWithProperties(props), SDL_DestroyWindow);
   if (!window) {
     SDL_Log("Failed to create window!");
@@ -57,6 +161,7 @@ int main(int argc, char** argv) {
   SDL_DestroyProperties(props);
 
   std::shared_ptr<SDL_Renderer> renderer = std::shared_ptr<SDL_Renderer>(SDL_CreateRenderer(window.get(), NULL, SDL_RENDERER_PRESENTVSYNC), SDL_DestroyRenderer);
+  handler_lock.unlock();
   if (!renderer) {
     SDL_Log("Failed to create renderer!");
     return 1;
@@ -64,15 +169,6 @@ int main(int argc, char** argv) {
 
   SDL_SetRenderDrawBlendMode(renderer.get(), SDL_BLENDMODE_BLEND);
 
-  std::shared_ptr<SDL_Texture> texture = create_capture_texture(renderer, capture);
-
-  if (!texture) {
-    SDL_Log("Failed to create capture texture!");
-    return 1;
-  }
-
-  SDL_SetTextureScaleMode(texture.get(), SDL_SCALEMODE_NEAREST);
-
   if (TTF_Init() < 0) {
     SDL_Log("Failed to init TTF!");
     return 1;
@@ -87,39 +183,207 @@ int main(int argc, char** argv) {
   std::shared_ptr<SDL_Surface> icon = std::shared_ptr<SDL_Surface>(SDL_CreateSurfaceFrom(icon_data, ICON_WIDTH, ICON_HEIGHT, ICON_WIDTH * 4, SDL_PIXELFORMAT_RGBA32), SDL_DestroySurface);
   SDL_SetWindowIcon(window.get(), icon.get());
 
-  CameraSmooth camera;
-  auto machine = CappyMachine::make(config, renderer, capture, texture, camera, font);
-  machine->set_state<MoveState>();
+  // held by the main thread while it changes the capture, the daemon reads
+  // pixels for its clients on another thread.
+  std::mutex capture_lock;
 
-  // setting bounds in capture, if width or height is <= 0
-  // then it sets the crop to the capture width or height.
-  if (config.window_pre_crop[0] < 0) config.window_pre_crop[0] = 0;
-  if (config.window_pre_crop[1] < 0) config.window_pre_crop[1] = 0;
-  if (config.window_pre_crop[2] <= 0) config.window_pre_crop[2] = capture.width;
-  if (config.window_pre_crop[3] <= 0) config.window_pre_crop[3] = capture.height;
+  DaemonServer daemon;
+  if (daemon_mode) {
+    if (!daemon.listen(capture, capture_lock, DAEMON_SHOW_EVENT, DAEMON_CAPTURE_EVENT)) {
+      return 1;
+    }
+    SDL_Log("Waiting for captures, run cappy or send SIGUSR1 to this process (socket: '%s')", cappy_socket_path().c_str());
+  } else if (!capture_done.get()) {
+    if (!capture_options.shm_name.empty()) {
+      SDL_Log("Failed to attach shared memory frames: '%s'", capture_options.shm_name.c_str());
+    } else if (!capture_options.file.empty()) {
+      SDL_Log("Failed to open: '%s'", capture_options.file.c_str());
+    } else {
+      SDL_Log("Failed to capture screen!");
+    }
+    return 1;
+  } else {
+    SDL_Log("Captured %dx%d screen (%zu regions) using %s in %.1f ms", capture.width, capture.height, capture.regions.size(), capture_backend_name(capture.backend), capture_ns / 1e6);
+  }
 
-  if (config.window_pre_crop[0] > capture.width) config.window_pre_crop[0] = capture.width;
-  if (config.window_pre_crop[1] > capture.height) config.window_pre_crop[1] = capture.height;
-  if (config.window_pre_crop[2] > capture.width) config.window_pre_crop[2] = capture.width;
-  if (config.window_pre_crop[3] > capture.height) config.window_pre_crop[3] = capture.height;
+  CameraSmooth camera;
+  auto machine = CappyMachine::make(config, renderer, capture, camera, font);
+  machine->set_state<MoveState>();
 
-  // set x and y to top left most point
-  // and calculate width and height
-  machine->current_x = std::min(config.window_pre_crop[0], config.window_pre_crop[2]);
-  machine->current_y = std::min(config.window_pre_crop[1], config.window_pre_crop[3]);
-  machine->current_w = std::abs(config.window_pre_crop[2] - config.window_pre_crop[0]);
-  machine->current_h = std::abs(config.window_pre_crop[3] - config.window_pre_crop[1]);
+  if (!daemon_mode && !present_capture(window.get(), primary_bounds, capture, config, *machine)) {
+    SDL_Log("Failed to create capture texture!");
+    return 1;
+  }
 
   std::shared_ptr<SDL_Cursor> move_cursor = std::shared_ptr<SDL_Cursor>(SDL_CreateSystemCursor(SDL_SYSTEM_CURSOR_SIZEALL), SDL_DestroyCursor);
   SDL_Cursor* default_cursor              = SDL_GetDefaultCursor();
 
+  LiveCapture live;
+  std::vector<SDL_Rect> live_updates;
+
+  FileWatcher watcher;
+  if (watch_mode && !watcher.start(capture_options.file)) {
+    SDL_Log("Failed to watch: '%s'", capture_options.file.c_str());
+  }
+
+  Recorder& recorder = machine->get_recorder();
+
+  // Every FILE argument is an image of the session and Ctrl+N adds screen
+  // captures. The shown image's pixels are always in capture and its
+  // textures in the machine, switching swaps them with the session's.
+  CaptureOptions screen_options = capture_options;
+  screen_options.file.clear();
+  screen_options.raw_width  = 0;
+  screen_options.raw_height = 0;
+  screen_options.shm_name.clear();
+
+  ImageSession session;
+  size_t active = session.add(capture_options, std::make_unique<Capture>());
+  size_t wanted = active; // shown as soon as it is decoded
+  for (const std::string& file : more_files) {
+    CaptureOptions options = capture_options;
+    options.file           = file;
+    session.add(options, nullptr);
+  }
+  session.start((size_t)std::max(config.session_memory_mb, 1) * 1024 * 1024, (size_t)std::max(config.session_texture_mb, 1) * 1024 * 1024);
+  session.use(active, capture);
+
+  // the images next to the shown one are decoded ahead, so stepping through
+  // the session doesn't wait for them.
+  auto prefetch = [&]() {
+    size_t count = session.size();
+    if (count < 2) return;
+    session.request((active + 1) % count);
+    session.request((active + count - 1) % count);
+  };
+  prefetch();
+
   float last_x = 0.0f;
   float last_y = 0.0f;
 
+  bool first_frame  = true;
+  bool visible      = !daemon_mode;
+  Uint64 idle_since = SDL_GetTicksNS();
+
   bool quit = false;
+
+  // the daemon keeps running with the window hidden, otherwise cappy quits
+  auto dismiss = [&]() {
+    if (!daemon_mode) {
+      quit = true;
+      return;
+    }
+    live.stop();
+    recorder.clear();
+    machine->set_state<MoveState>();
+    SDL_HideWindow(window.get());
+    visible = false;
+  };
+
+  // live mode and the recording carry on with a capture that replaced the
+  // one they started on
+  auto continue_with_capture = [&]() {
+    if (live.is_running() && !live.start(capture)) {
+      SDL_Log("Failed to restart live mode!");
+    }
+    // both only update the 8 bit pixels, and need them as RGB
+    if (live.is_running() || recorder.is_recording()) {
+      capture.drop_low_bits();
+      capture.expand();
+    }
+    if (recorder.is_recording() && !recorder.push(capture, nullptr)) {
+      SDL_Log("The screen layout changed, restarting the recording");
+      recorder.start(capture, recorder_options(config));
+    }
+  };
+
+  // F5 and capture requests from daemon clients
+  auto grab_again = [&]() {
+    if (!recapture(window.get(), capture, capture_options, *machine)) {
+      SDL_Log("Failed to recapture screen!");
+      return false;
+    }
+    continue_with_capture();
+    return true;
+  };
+
+  auto show_image = [&](size_t index) {
+    if (index >= session.size()) return;
+    wanted = index;
+    if (index == active) return;
+
+    SessionImage& to = session.get(index);
+    if (!to.is_resident()) {
+      session.request(index);
+      SDL_Log("Decoding '%s'...", to.options.file.c_str());
+      return;
+    }
+
+    // live mode and the recording belong to the image that is left
+    live.stop();
+    recorder.clear();
+    machine->set_state<MoveState>();
+
+    SessionImage& from = session.get(active);
+    from.has_view      = true;
+    from.position      = camera.get_position();
+    from.scale         = camera.get_scale();
+    from.crop          = {machine->current_x, machine->current_y, machine->current_w, machine->current_h};
+
+    capture.swap(*to.capture);
+    std::swap(from.capture, to.capture);
+    machine->swap_textures(from.textures);
+    machine->swap_textures(to.textures);
+    active          = index;
+    capture_options = to.options;
+
+    camera.cancel_zoom();
+    camera.cancel_pan();
+    if (to.has_view) {
+      camera.set_position(to.position);
+      camera.set_scale(to.scale);
+      machine->current_x = to.crop.x;
+      machine->current_y = to.crop.y;
+      machine->current_w = to.crop.w;
+      machine->current_h = to.crop.h;
+    } else {
+      camera.reset();
+      machine->current_x = 0;
+      machine->current_y = 0;
+      machine->current_w = capture.width;
+      machine->current_h = capture.height;
+    }
+
+    // textures that were evicted are uploaded again
+    if (machine->get_textures().empty() && !machine->start_upload(capture.width / 2.0f, capture.height / 2.0f)) {
+      SDL_Log("Failed to create capture texture!");
+    }
+
+    if (watch_mode) {
+      watcher.stop();
+      if (!capture_options.file.empty() && !watcher.start(capture_options.file)) {
+        SDL_Log("Failed to watch: '%s'", capture_options.file.c_str());
+      }
+    }
+
+    session.use(active, capture);
+    session.trim(active);
+    prefetch();
+
+    SDL_Log("Showing image %zu of %zu: '%s'", active + 1, session.size(), capture_options.file.empty() ? "screen capture" : capture_options.file.c_str());
+  };
+
   while (!quit) {
     SDL_Event event;
 
+    // a hidden daemon sleeps until a capture request comes in
+    if (!visible) {
+      SDL_WaitEvent(NULL);
+    }
+
+    // released while waiting for vsync, daemon clients read pixels meanwhile
+    std::unique_lock<std::mutex> lock(capture_lock);
+
     float mx, my;
     SDL_GetMouseState(&mx, &my);
     last_x = mx;
@@ -133,11 +397,43 @@ int main(int argc, char** argv) {
           quit = true;
           break;
         }
+        case SDL_EVENT_WINDOW_CLOSE_REQUESTED: {
+          dismiss();
+          break;
+        }
+        case DAEMON_CAPTURE_EVENT: {
+          // a client wants fresh pixels, a hidden window stays hidden
+          daemon.finish_capture(visible ? grab_again() : capture.capture(capture_options));
+          break;
+        }
+        case DAEMON_SHOW_EVENT: {
+          if (visible) {
+            SDL_RaiseWindow(window.get());
+            break;
+          }
+
+          start_ns = SDL_GetTicksNS();
+          if (!capture.capture(capture_options)) {
+            SDL_Log("Failed to capture screen!");
+            break;
+          }
+          SDL_Log("Captured %dx%d screen (%zu regions) using %s in %.1f ms", capture.width, capture.height, capture.regions.size(), capture_backend_name(capture.backend), (SDL_GetTicksNS() - start_ns) / 1e6);
+
+          camera.reset();
+          machine->set_state<MoveState>();
+          if (!present_capture(window.get(), primary_bounds, capture, config, *machine)) {
+            SDL_Log("Failed to create capture texture!");
+            break;
+          }
+          visible     = true;
+          first_frame = true;
+          break;
+        }
         case SDL_EVENT_KEY_DOWN: {
           SDL_Keycode code = event.key.keysym.sym;
           SDL_Keymod mod   = SDL_GetModState();
           if (code == SDLK_q) {
-            quit = true;
+            dismiss();
           } else if (code == SDLK_f) {
             machine->set_state<FlashlightState>();
             continue;
@@ -146,6 +442,38 @@ int main(int argc, char** argv) {
             continue;
           } else if (code == SDLK_g) {
             machine->toggle_grid();
+          } else if (code == SDLK_r && mod & SDL_KMOD_CTRL) {
+            // recordings and live mode write into the pixels
+            capture.expand();
+            if (recorder.is_recording()) {
+              recorder.stop();
+              SDL_Log("Recording stopped after %zu frames", recorder.frame_count());
+            } else if (capture.is_tiled()) {
+              SDL_Log("Tiled images can't be recorded!");
+            } else if (recorder.start(capture, recorder_options(config))) {
+              SDL_Log("Recording started");
+              if (capture.depth > 8) SDL_Log("Recording keeps 8 bits per channel, the extra precision is dropped");
+              capture.drop_low_bits();
+            } else if (!capture.writable()) {
+              SDL_Log("Frames shared with another process can't be recorded!");
+            } else {
+              SDL_Log("Failed to start recording!");
+            }
+          } else if (code == SDLK_t) {
+            if (!recorder.has_frames()) {
+              SDL_Log("Nothing recorded yet, start a recording with Ctrl+R");
+              continue;
+            }
+            if (!recorder.is_recording()) {
+              // the capture may have moved on since the recording stopped
+              if (!recorder.restore_latest(capture) || !machine->upload_capture()) {
+                SDL_Log("The recording doesn't fit the current capture anymore!");
+                recorder.clear();
+                continue;
+              }
+            }
+            machine->set_state<TimelineState>();
+            continue;
           } else if (code == SDLK_r) {
             // camera.reset();
             machine->current_x = 0;
@@ -156,6 +484,34 @@ int main(int argc, char** argv) {
             continue;
           } else if (code == SDLK_m) {
             SDL_MinimizeWindow(window.get());
+          } else if (code == SDLK_F5) {
+            grab_again();
+          } else if (code == SDLK_TAB && !daemon_mode) {
+            size_t count = session.size();
+            show_image((mod & SDL_KMOD_SHIFT) ? (wanted + count - 1) % count : (wanted + 1) % count);
+          } else if (code >= SDLK_1 && code <= SDLK_9 && !daemon_mode) {
+            show_image(code - SDLK_1);
+          } else if (code == SDLK_n && mod & SDL_KMOD_CTRL && !daemon_mode) {
+            auto grabbed = std::make_unique<Capture>();
+            if (!grab(window.get(), *grabbed, screen_options)) {
+              SDL_Log("Failed to capture screen!");
+              continue;
+            }
+            show_image(session.add(screen_options, std::move(grabbed)));
+          } else if (code == SDLK_l) {
+            capture.expand();
+            if (live.is_running()) {
+              live.stop();
+              SDL_Log("Live mode off");
+            } else if (live.start(capture)) {
+              SDL_Log("Live mode on");
+              if (capture.depth > 8) SDL_Log("Live mode keeps 8 bits per channel, the extra precision is dropped");
+              capture.drop_low_bits();
+            } else if (!capture.is_screen()) {
+              SDL_Log("Live mode only works on screen captures!");
+            } else {
+              SDL_Log("Live mode needs the XDamage and XFixes extensions!");
+            }
           } else if (code == SDLK_s && mod & SDL_KMOD_CTRL) {
             static const SDL_DialogFileFilter filters[] = {
                 {"PNG images", "png"},
@@ -237,9 +593,9 @@ int main(int argc, char** argv) {
           free(event.user.data1);
 
           constexpr int comp = 3;
-          int stride         = machine->get_capture().stride;
-          int index          = machine->current_y * stride + machine->current_x;
-          RGB* pixels        = &machine->get_capture().pixels[index];
+          RGB fill           = {config.background_color[0], config.background_color[1], config.background_color[2]};
+          std::vector<RGB> pixels((size_t)machine->current_w * machine->current_h);
+          machine->get_capture().read(machine->current_x, machine->current_y, machine->current_w, machine->current_h, pixels.data(), machine->current_w, fill);
 
           if (path.starts_with("file://")) {
             path.erase(0, 7);
@@ -251,7 +607,7 @@ int main(int argc, char** argv) {
             path += ".png";
           }
 
-          if (stbi_write_png(path.c_str(), machine->current_w, machine->current_h, comp, pixels, comp * stride) == 0) {
+          if (stbi_write_png(path.c_str(), machine->current_w, machine->current_h, comp, pixels.data(), comp * machine->current_w) == 0) {
             SDL_Log("Failed to save file: '%s': %s", path.c_str(), strerror(errno));
           } else {
             SDL_Log("Saved file: '%s'", path.c_str());
@@ -264,12 +620,125 @@ int main(int argc, char** argv) {
       }
     }
 
+    if (!visible) continue;
+
+    // decodes finished in the background, the image asked for may be ready
+    if (session.poll()) {
+      SessionImage& image = session.get(wanted);
+      if (wanted != active && image.is_resident()) {
+        show_image(wanted);
+      } else if (wanted != active && image.failed) {
+        SDL_Log("Failed to open: '%s'", image.options.file.c_str());
+        wanted = active;
+      }
+      session.trim(active);
+    }
+
+    if (machine->is_uploading() && !machine->continue_upload()) {
+      SDL_Log("Failed to upload capture texture!");
+    }
+
+    // a producer process wrote a new frame into shared memory
+    if (capture.poll() && !machine->upload_capture()) {
+      SDL_Log("Failed to upload shared memory frame!");
+    }
+
+    // the timeline shows older frames, everywhere else the capture is kept at
+    // the newest one so live mode and the recording continue from there.
+    if (!machine->is_state_active<TimelineState>()) {
+      if (recorder.has_frames() && recorder.current_frame() + 1 != recorder.frame_count()) {
+        std::vector<SDL_Rect> changed;
+        recorder.seek(capture, recorder.frame_count() - 1, changed);
+        machine->update_capture(changed);
+      }
+
+      // the watched file was saved again, usually with only a small part of it
+      // changed. It is decoded on the session's pool and only the areas that
+      // differ are uploaded, the camera and the crop stay where they are.
+      if (watcher.poll()) session.reload(active);
+
+      size_t reloaded;
+      std::unique_ptr<Capture> next;
+      while (session.take_reload(reloaded, next)) {
+        SessionImage& image = session.get(reloaded);
+        if (!next) {
+          SDL_Log("Failed to reload: '%s'", image.options.file.c_str());
+          continue;
+        }
+        // left meanwhile, the image is shown from the new pixels next time
+        if (reloaded != active) {
+          if (image.is_resident()) {
+            image.capture = std::move(next);
+            image.textures.clear();
+          }
+          continue;
+        }
+
+        Uint64 diff_start = SDL_GetTicksNS();
+        std::vector<CaptureArea> areas;
+        if (capture.update_from(*next, areas)) {
+          std::vector<SDL_Rect> changed;
+          for (const CaptureArea& area : areas) {
+            changed.push_back({area.x, area.y, area.width, area.height});
+          }
+          machine->update_capture(changed);
+          if (recorder.is_recording() && !changed.empty()) {
+            recorder.push(capture, &changed);
+          }
+          SDL_Log("Reloaded '%s', %zu changed areas in %.1f ms", image.options.file.c_str(), areas.size(), (SDL_GetTicksNS() - diff_start) / 1e6);
+        } else {
+          // e.g. the image changed size, it is shown as decoded
+          capture.swap(*next);
+          if (!show_recaptured(capture, *machine)) {
+            SDL_Log("Failed to upload capture texture!");
+          }
+          continue_with_capture();
+        }
+        session.use(active, capture);
+      }
+
+      if (live.is_running()) {
+        // 0 under Wayland, where live mode doesn't start anyway
+        Sint64 own_window = SDL_GetNumberProperty(SDL_GetWindowProperties(window.get()), SDL_PROP_WINDOW_X11_WINDOW_NUMBER, 0);
+
+        live_updates.clear();
+        live.poll(capture, (unsigned long)own_window, live_updates);
+        machine->update_capture(live_updates);
+
+        if (recorder.is_recording() && !live_updates.empty()) {
+          recorder.push(capture, &live_updates);
+        }
+      }
+    }
+
+    // Pixels that nothing writes to anymore are compressed after a while, see
+    // Capture::compact, a step per frame. Daemon clients read them from
+    // another thread.
+    if (daemon_mode || live.is_running() || recorder.has_frames() || machine->is_uploading() || capture.is_compact()) {
+      idle_since = SDL_GetTicksNS();
+    } else if (config.compact_after_s > 0 && SDL_GetTicksNS() - idle_since >= (Uint64)config.compact_after_s * 1000000000) {
+      if (machine->compact_capture()) {
+        SDL_Log("Compressed the capture's pixels to %.1f MB", capture.store.size() / 1e6);
+        session.use(active, capture);
+        idle_since = SDL_GetTicksNS();
+      } else if (!machine->is_compacting()) {
+        // captures that don't compress are tried again later
+        idle_since = SDL_GetTicksNS();
+      }
+    }
+
     machine->render_clear(config.background_color[0], config.background_color[1], config.background_color[2]);
     machine->render_capture();
     machine->render_grid(config.grid_size, config.grid_color[0], config.grid_color[1], config.grid_color[2]);
     machine->draw_frame(machine);
+    lock.unlock();
 
     machine->render_present();
+
+    if (first_frame) {
+      SDL_Log("Time to first frame: %.1f ms", (SDL_GetTicksNS() - start_ns) / 1e6);
+      first_frame = false;
+    }
   }
 
   TTF_CloseFont(font);
@@ -280,7 +749,195 @@ int main(int argc, char** argv) {
   return 0;
 }
 
-std::shared_ptr<SDL_Texture> create_capture_texture(std::shared_ptr<SDL_Renderer> renderer, Capture& capture) {
-  std::shared_ptr<SDL_Surface> surface = std::shared_ptr<SDL_Surface>(SDL_CreateSurfaceFrom(capture.pixels, capture.width, capture.height, capture.stride * 3, SDL_PIXELFORMAT_RGB24), SDL_DestroySurface);
-  return std::shared_ptr<SDL_Texture>(SDL_CreateTextureFromSurface(renderer.get(), surface.get()), SDL_DestroyTexture);
+// Fits the window to a new capture, starts uploading it and shows the window.
+// The crop starts out as window_pre_crop, clamped to the capture.
+bool present_capture(SDL_Window* window, const SDL_Rect& primary_bounds, Capture& capture, const cappyConfig& config, CappyMachine& machine) {
+  // a screen capture covers all monitors, but stitched scroll captures and
+  // files can be much larger than the screen.
+  SDL_Rect display_bounds = {0, 0, capture.width, capture.height};
+  if (!capture.is_screen()) display_bounds = primary_bounds;
+
+  SDL_SetWindowSize(window, std::min(capture.width, display_bounds.w), std::min(capture.height, display_bounds.h));
+
+  // big captures take a while to upload, the first frames show a preview
+  // that fills in starting at the cursor.
+  float focus_x = capture.width / 2.0f;
+  float focus_y = capture.height / 2.0f;
+  if (capture.is_screen()) SDL_GetGlobalMouseState(&focus_x, &focus_y);
+
+  if (!machine.start_upload(focus_x, focus_y)) {
+    return false;
+  }
+
+  // setting bounds in capture, if the second corner's x or y is <= 0
+  // then it is the capture's right or bottom edge. That is decided before a
+  // window capture moves the corners, where it may end up <= 0 legitimately.
+  int crop[4] = {config.window_pre_crop[0], config.window_pre_crop[1], config.window_pre_crop[2], config.window_pre_crop[3]};
+  bool far_x  = crop[2] <= 0;
+  bool far_y  = crop[3] <= 0;
+  // the pre-crop is on the screen, a window capture relative to the window
+  if (capture.window) {
+    crop[0] -= capture.window_x;
+    crop[1] -= capture.window_y;
+    crop[2] -= capture.window_x;
+    crop[3] -= capture.window_y;
+  }
+  if (far_x) crop[2] = capture.width;
+  if (far_y) crop[3] = capture.height;
+
+  crop[0] = std::clamp(crop[0], 0, capture.width);
+  crop[1] = std::clamp(crop[1], 0, capture.height);
+  crop[2] = std::clamp(crop[2], 0, capture.width);
+  crop[3] = std::clamp(crop[3], 0, capture.height);
+
+  // set x and y to top left most point
+  // and calculate width and height
+  machine.current_x = std::min(crop[0], crop[2]);
+  machine.current_y = std::min(crop[1], crop[3]);
+  machine.current_w = std::abs(crop[2] - crop[0]);
+  machine.current_h = std::abs(crop[3] - crop[1]);
+
+  SDL_ShowWindow(window);
+  SDL_RaiseWindow(window);
+  return true;
+}
+
+// Captures into capture, with the window hidden while the screen is grabbed.
+bool grab(SDL_Window* window, Capture& capture, const CaptureOptions& options) {
+  // files and shared memory are just read again, the window can stay
+  bool hide = options.file.empty() && options.shm_name.empty();
+  if (hide) {
+    SDL_HideWindow(window);
+
+    // give the window manager a moment to unmap the window before grabbing
+    SDL_PumpEvents();
+    SDL_Delay(recapture_hide_ms);
+  }
+
+  if (options.scroll) {
+    SDL_Log("Scroll the content now, capturing stops once it didn't move for %d ms", options.scroll_idle_ms);
+  }
+
+  bool ok = capture.capture(options);
+
+  if (hide) {
+    SDL_ShowWindow(window);
+    SDL_RaiseWindow(window);
+  }
+  return ok;
+}
+
+// Grabs the screen again, or reads the file again, and uploads it. The camera
+// and crop are kept, the crop is only shrunk when the new capture is smaller.
+bool recapture(SDL_Window* window, Capture& capture, const CaptureOptions& options, CappyMachine& machine) {
+  return grab(window, capture, options) && show_recaptured(capture, machine);
+}
+
+// Uploads a capture that replaced the shown one, see recapture.
+bool show_recaptured(Capture& capture, CappyMachine& machine) {
+  if (!machine.upload_capture()) return false;
+
+  SDL_Log("Recaptured %dx%d screen (%zu regions) using %s", capture.width, capture.height, capture.regions.size(), capture_backend_name(capture.backend));
+
+  machine.current_x = std::min(machine.current_x, capture.width);
+  machine.current_y = std::min(machine.current_y, capture.height);
+  machine.current_w = std::min(machine.current_w, capture.width - machine.current_x);
+  machine.current_h = std::min(machine.current_h, capture.height - machine.current_y);
+
+  return true;
+}
+
+RecorderOptions recorder_options(const cappyConfig& config) {
+  RecorderOptions options;
+  options.max_frames    = std::max(config.record_frames, 1);
+  options.memory_budget = (size_t)std::max(config.record_memory_mb, 1) * 1024 * 1024;
+  options.spill_path    = config.record_spill_file;
+  return options;
+}
+
+// Parses the command line into options:
+//   --window <id>          capture the X11 window with this id
+//   --window-name <title>  capture the first window whose title contains title
+//   --pick-window          capture the window clicked next
+//   --raw WxH:FORMAT       read FILE as headerless pixels
+//   --shm NAME             show the frames written to a shared memory object
+//   --scroll               stitch captures together while the user scrolls
+//   --daemon               stay resident and capture whenever another cappy asks
+//   --watch FILE           open FILE and reload the shown image whenever it is written
+//   FILE...                open images or framebuffer dumps, the first is shown
+bool parse_args(int argc, char** argv, CaptureOptions& options, std::vector<std::string>& more_files, bool& daemon_mode, bool& watch_mode) {
+  static const std::pair<const char*, PixelFormat> raw_formats[] = {
+      {"rgb24", PixelFormat::RGB24},
+      {"bgr24", PixelFormat::BGR24},
+      {"rgba32", PixelFormat::RGBA32},
+      {"bgrx32", PixelFormat::BGRX32},
+      {"xrgb32", PixelFormat::XRGB32},
+      {"gray8", PixelFormat::GRAY8},
+  };
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--window" && i + 1 < argc) {
+      options.window = std::strtoul(argv[++i], nullptr, 0);
+      if (!options.window) {
+        SDL_Log("Invalid window id: '%s'", argv[i]);
+        return false;
+      }
+    } else if (arg == "--window-name" && i + 1 < argc) {
+      options.window = capture_find_window(argv[++i]);
+      if (!options.window) {
+        SDL_Log("No window found with a title containing: '%s'", argv[i]);
+        return false;
+      }
+    } else if (arg == "--pick-window") {
+      SDL_Log("Click the window to capture...");
+      options.window = capture_pick_window();
+      if (!options.window) {
+        SDL_Log("No window picked!");
+        return false;
+      }
+    } else if (arg == "--raw" && i + 1 < argc) {
+      char format[16] = {0};
+      if (std::sscanf(argv[++i], "%dx%d:%15s", &options.raw_width, &options.raw_height, format) != 3 || options.raw_width <= 0 || options.raw_height <= 0) {
+        SDL_Log("Invalid raw geometry: '%s', expected WIDTHxHEIGHT:FORMAT", argv[i]);
+        return false;
+      }
+
+      auto it = std::find_if(std::begin(raw_formats), std::end(raw_formats), [&](const auto& f) { return std::string(f.first) == format; });
+      if (it == std::end(raw_formats)) {
+        SDL_Log("Unknown raw format: '%s'", format);
+        return false;
+      }
+      options.raw_format = it->second;
+    } else if (arg == "--scroll") {
+      options.scroll = true;
+    } else if (arg == "--daemon") {
+      daemon_mode = true;
+    } else if (arg == "--watch" && i + 1 < argc) {
+      watch_mode = true;
+      if (options.file.empty()) {
+        options.file = argv[++i];
+      } else {
+        more_files.push_back(argv[++i]);
+      }
+    } else if (arg == "--shm" && i + 1 < argc) {
+      options.shm_name = argv[++i];
+      if (!options.shm_name.starts_with("/")) options.shm_name.insert(0, "/");
+    } else if (!arg.starts_with("--")) {
+      if (options.file.empty()) {
+        options.file = arg;
+      } else {
+        more_files.push_back(arg);
+      }
+    } else {
+      SDL_Log("Unknown argument: '%s'", argv[i]);
+      return false;
+    }
+  }
+
+  if (options.raw_width > 0 && options.file.empty()) {
+    SDL_Log("--raw needs a file to read!");
+    return false;
+  }
+  return true;
 }
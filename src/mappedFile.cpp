@@ -0,0 +1,154 @@
+#include "mappedFile.h"
+
+#include <algorithm>
+
+#if _WIN32
+  #include <windows.h>
+#else
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+MappedFile::~MappedFile() {
+  close();
+}
+
+bool MappedFile::open(const char* filename) {
+  close();
+
+#if _WIN32
+  file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    file = nullptr;
+    return false;
+  }
+
+  LARGE_INTEGER file_size;
+  if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+    close();
+    return false;
+  }
+
+  mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+  if (!mapping) {
+    close();
+    return false;
+  }
+
+  data = (uint8_t*)MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+  if (!data) {
+    close();
+    return false;
+  }
+  size = (size_t)file_size.QuadPart;
+#else
+  int fd = ::open(filename, O_RDONLY);
+  if (fd < 0) return false;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    ::close(fd);
+    return false;
+  }
+
+  void* mapped = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (mapped == MAP_FAILED) return false;
+
+  data = (uint8_t*)mapped;
+  size = st.st_size;
+#endif
+
+  return true;
+}
+
+bool MappedFile::read(const char* filename) {
+  close();
+
+#if _WIN32
+  HANDLE handle = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (handle == INVALID_HANDLE_VALUE) return false;
+
+  LARGE_INTEGER file_size;
+  if (!GetFileSizeEx(handle, &file_size) || file_size.QuadPart == 0) {
+    CloseHandle(handle);
+    return false;
+  }
+
+  uint8_t* buffer = (uint8_t*)VirtualAlloc(nullptr, (size_t)file_size.QuadPart, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+  size_t done     = 0;
+  while (buffer && done < (size_t)file_size.QuadPart) {
+    DWORD chunk = (DWORD)std::min<size_t>((size_t)file_size.QuadPart - done, 1 << 30);
+    DWORD got   = 0;
+    if (!ReadFile(handle, buffer + done, chunk, &got, nullptr) || got == 0) break;
+    done += got;
+  }
+  CloseHandle(handle);
+
+  // the file was truncated while it was read
+  if (buffer && done != (size_t)file_size.QuadPart) {
+    VirtualFree(buffer, 0, MEM_RELEASE);
+    return false;
+  }
+#else
+  int fd = ::open(filename, O_RDONLY);
+  if (fd < 0) return false;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    ::close(fd);
+    return false;
+  }
+
+  // anonymous pages, so close() frees them like a mapping
+  void* mapped    = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  uint8_t* buffer = mapped == MAP_FAILED ? nullptr : (uint8_t*)mapped;
+  size_t done     = 0;
+  while (buffer && done < (size_t)st.st_size) {
+    ssize_t got = pread(fd, buffer + done, st.st_size - done, done);
+    if (got <= 0) break;
+    done += got;
+  }
+  ::close(fd);
+
+  // the file was truncated while it was read
+  if (buffer && done != (size_t)st.st_size) {
+    munmap(buffer, st.st_size);
+    return false;
+  }
+#endif
+
+  if (!buffer) return false;
+  data   = buffer;
+  size   = done;
+  copied = true;
+  return true;
+}
+
+void MappedFile::drop_pages(size_t offset, size_t length) {
+#if !_WIN32
+  if (copied) return;
+  size_t page  = (size_t)sysconf(_SC_PAGESIZE);
+  size_t begin = offset / page * page;
+  size_t end   = std::min(size, offset + length);
+  if (data && end > begin) madvise(data + begin, end - begin, MADV_DONTNEED);
+#endif
+}
+
+void MappedFile::close() {
+#if _WIN32
+  if (data && copied) VirtualFree(data, 0, MEM_RELEASE);
+  else if (data) UnmapViewOfFile(data);
+  if (mapping) CloseHandle(mapping);
+  if (file) CloseHandle(file);
+  mapping = nullptr;
+  file    = nullptr;
+#else
+  if (data) munmap(data, size);
+#endif
+  data   = nullptr;
+  size   = 0;
+  copied = false;
+}
@@ -0,0 +1,56 @@
+#ifndef _MAPPED_FILE_H_
+#define _MAPPED_FILE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+// A file mapped copy-on-write into memory. Writes through data change only
+// this process' view of the file, never the file itself.
+class MappedFile {
+public:
+  MappedFile() = default;
+  ~MappedFile();
+
+  MappedFile(const MappedFile&)            = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  bool open(const char* filename);
+  void close();
+
+  // Reads the file into memory of its own instead of mapping it, for files
+  // that may be rewritten or truncated while data is in use.
+  bool read(const char* filename);
+
+  bool is_open() const {
+    return data != nullptr;
+  }
+
+  // Lets the system take back the pages of size bytes at offset, e.g. once a
+  // file bigger than the memory was read through. They are read from the
+  // file again when touched, anything written to them is lost. Does nothing
+  // for files that were read.
+  void drop_pages(size_t offset, size_t size);
+
+  void swap(MappedFile& other) {
+    std::swap(data, other.data);
+    std::swap(size, other.size);
+    std::swap(copied, other.copied);
+#if _WIN32
+    std::swap(file, other.file);
+    std::swap(mapping, other.mapping);
+#endif
+  }
+
+  uint8_t* data = nullptr;
+  size_t size   = 0;
+
+private:
+  bool copied = false;
+#if _WIN32
+  void* file    = nullptr;
+  void* mapping = nullptr;
+#endif
+};
+
+#endif
@@ -0,0 +1,438 @@
+#include "recorder.h"
+
+#include <algorithm>
+#include <cstring>
+
+// a literal run of an rle delta only ends at this many zero bytes, shorter
+// gaps are cheaper to store inside the literal.
+static constexpr size_t min_zero_run = 4;
+
+static void put_varint(std::vector<uint8_t>& out, size_t value) {
+  while (value >= 0x80) {
+    out.push_back((uint8_t)(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back((uint8_t)value);
+}
+
+static size_t get_varint(const uint8_t*& p) {
+  size_t value = 0;
+  int shift    = 0;
+  while (*p & 0x80) {
+    value |= (size_t)(*p++ & 0x7f) << shift;
+    shift += 7;
+  }
+  value |= (size_t)(*p++) << shift;
+  return value;
+}
+
+static void put_u32(std::vector<uint8_t>& out, uint32_t value) {
+  size_t at = out.size();
+  out.resize(at + 4);
+  std::memcpy(out.data() + at, &value, 4);
+}
+
+static uint32_t get_u32(const uint8_t* p) {
+  uint32_t value;
+  std::memcpy(&value, p, 4);
+  return value;
+}
+
+// Encodes src as [zero run][literal length][literal bytes] triples. The XOR of
+// two frames is zero wherever nothing changed, so those runs cost a byte.
+static void rle_encode(const uint8_t* src, size_t size, std::vector<uint8_t>& out) {
+  size_t i = 0;
+  while (i < size) {
+    size_t zeros = 0;
+    while (i + zeros < size && src[i + zeros] == 0) zeros++;
+    i += zeros;
+    if (i == size) break;
+
+    size_t start = i;
+    while (i < size) {
+      if (src[i] != 0) {
+        i++;
+        continue;
+      }
+      size_t z = 0;
+      while (i + z < size && src[i + z] == 0 && z < min_zero_run) z++;
+      if (z >= min_zero_run || i + z == size) break;
+      i += z;
+    }
+
+    put_varint(out, zeros);
+    put_varint(out, i - start);
+    out.insert(out.end(), src + start, src + i);
+  }
+}
+
+static void rle_decode(const uint8_t* src, size_t size, uint8_t* dst, size_t dst_size) {
+  std::memset(dst, 0, dst_size);
+
+  const uint8_t* end = src + size;
+  size_t pos         = 0;
+  while (src < end) {
+    pos += get_varint(src);
+    size_t length = get_varint(src);
+    std::memcpy(dst + pos, src, length);
+    src += length;
+    pos += length;
+  }
+}
+
+static int seek_file(FILE* file, uint64_t offset) {
+#if _WIN32
+  return _fseeki64(file, (__int64)offset, SEEK_SET);
+#else
+  return fseeko(file, (off_t)offset, SEEK_SET);
+#endif
+}
+
+Recorder::~Recorder() {
+  clear();
+}
+
+bool Recorder::start(const Capture& capture, const RecorderOptions& recorder_options) {
+  clear();
+  // seeking writes into capture.pixels, which must be expanded
+  if (!capture.captured || !capture.writable() || !capture.pixels) return false;
+
+  options = recorder_options;
+  regions = capture.regions;
+
+  pixel_count = 0;
+  for (const CaptureRegion& region : regions) {
+    region_first_tile.push_back(tiles.size());
+    for (int y = 0; y < region.height; y += tile_size) {
+      for (int x = 0; x < region.width; x += tile_size) {
+        tiles.push_back({(int)(&region - regions.data()), region.x + x, region.y + y, std::min(tile_size, region.width - x), std::min(tile_size, region.height - y)});
+      }
+    }
+    pixel_count = std::max(pixel_count, region.offset + (size_t)region.width * region.height);
+  }
+  marked.assign(tiles.size(), 0);
+
+  base.assign(capture.pixels, capture.pixels + pixel_count);
+  latest   = base;
+  memory   = 0;
+  position = 0;
+
+  // the budget only holds the deltas, a budget the two full frames already
+  // take up is likely set too low
+  size_t frames = 2 * pixel_count * sizeof(RGB);
+  if (frames > options.memory_budget) {
+    SDL_Log("The recording keeps %.1f MB of full frames besides its %.1f MB budget for changes", frames / 1e6, options.memory_budget / 1e6);
+  }
+
+  if (!options.spill_path.empty()) {
+    spill = fopen(options.spill_path.c_str(), "w+b");
+    if (!spill) {
+      SDL_Log("Failed to open recording spill file: '%s', dropping old frames instead", options.spill_path.c_str());
+    }
+  }
+
+  recording = true;
+  return true;
+}
+
+void Recorder::stop() {
+  recording = false;
+}
+
+void Recorder::clear() {
+  recording = false;
+
+  regions.clear();
+  region_first_tile.clear();
+  tiles.clear();
+  marked.clear();
+  pixel_count = 0;
+
+  base   = {};
+  latest = {};
+  deltas.clear();
+  position = 0;
+  memory   = 0;
+
+  if (spill) {
+    fclose(spill);
+    std::remove(options.spill_path.c_str());
+    spill = nullptr;
+  }
+  spill_end = 0;
+  spill_free.clear();
+}
+
+bool Recorder::same_layout(const Capture& capture) const {
+  if (capture.regions.size() != regions.size()) return false;
+  for (size_t i = 0; i < regions.size(); i++) {
+    const CaptureRegion& a = regions[i];
+    const CaptureRegion& b = capture.regions[i];
+    if (a.x != b.x || a.y != b.y || a.width != b.width || a.height != b.height || a.offset != b.offset) return false;
+  }
+  return true;
+}
+
+void Recorder::mark_tiles(const SDL_Rect& rect) {
+  for (size_t r = 0; r < regions.size(); r++) {
+    const CaptureRegion& region = regions[r];
+    SDL_Rect bounds             = {region.x, region.y, region.width, region.height};
+    SDL_Rect area;
+    if (!SDL_GetRectIntersection(&rect, &bounds, &area)) continue;
+
+    int tiles_x = (region.width + tile_size - 1) / tile_size;
+    int tx1     = (area.x - region.x) / tile_size;
+    int ty1     = (area.y - region.y) / tile_size;
+    int tx2     = (area.x + area.w - 1 - region.x) / tile_size;
+    int ty2     = (area.y + area.h - 1 - region.y) / tile_size;
+    for (int ty = ty1; ty <= ty2; ty++) {
+      for (int tx = tx1; tx <= tx2; tx++) {
+        marked[region_first_tile[r] + (size_t)ty * tiles_x + tx] = 1;
+      }
+    }
+  }
+}
+
+bool Recorder::push(const Capture& capture, const std::vector<SDL_Rect>* dirty) {
+  if (!recording || !same_layout(capture)) return false;
+
+  if (dirty) {
+    std::fill(marked.begin(), marked.end(), 0);
+    for (const SDL_Rect& rect : *dirty) mark_tiles(rect);
+  } else {
+    std::fill(marked.begin(), marked.end(), 1);
+  }
+
+  encoded.clear();
+  for (size_t t = 0; t < tiles.size(); t++) {
+    if (!marked[t]) continue;
+
+    const Tile& tile            = tiles[t];
+    const CaptureRegion& region = regions[tile.region];
+    size_t row_bytes            = (size_t)tile.width * sizeof(RGB);
+    size_t first                = region.offset + (size_t)(tile.y - region.y) * region.width + (tile.x - region.x);
+
+    scratch.resize(row_bytes * tile.height);
+    bool changed = false;
+    for (int row = 0; row < tile.height; row++) {
+      const uint8_t* now = (const uint8_t*)(capture.pixels + first + (size_t)row * region.width);
+      const uint8_t* old = (const uint8_t*)(latest.data() + first + (size_t)row * region.width);
+      uint8_t* out       = scratch.data() + row * row_bytes;
+      for (size_t i = 0; i < row_bytes; i++) {
+        out[i] = now[i] ^ old[i];
+        changed |= out[i] != 0;
+      }
+    }
+    if (!changed) continue;
+
+    put_u32(encoded, (uint32_t)t);
+    size_t size_at = encoded.size();
+    put_u32(encoded, 0);
+    rle_encode(scratch.data(), scratch.size(), encoded);
+    uint32_t size = (uint32_t)(encoded.size() - size_at - 4);
+    std::memcpy(encoded.data() + size_at, &size, 4);
+
+    for (int row = 0; row < tile.height; row++) {
+      size_t index = first + (size_t)row * region.width;
+      std::copy(capture.pixels + index, capture.pixels + index + tile.width, latest.data() + index);
+    }
+  }
+
+  // capture.pixels shows the newest frame now, even if it was seeked away.
+  // A frame that looks exactly like the one before it is not worth a step in
+  // the timeline.
+  position = deltas.size();
+  if (encoded.empty()) return true;
+
+  Delta delta;
+  delta.data = encoded;
+  memory += delta.data.size();
+  deltas.push_back(std::move(delta));
+  position = deltas.size();
+
+  enforce_limits();
+  return true;
+}
+
+bool Recorder::seek(Capture& capture, size_t frame, std::vector<SDL_Rect>& changed) {
+  if (!has_frames() || !same_layout(capture)) return false;
+  capture.expand();
+
+  frame = std::min(frame, frame_count() - 1);
+  if (frame == position) return true;
+
+  std::fill(marked.begin(), marked.end(), 0);
+
+  bool ok = true;
+  while (position != frame) {
+    const Delta& delta = frame > position ? deltas[position] : deltas[position - 1];
+
+    const std::vector<uint8_t>* data = load(delta);
+    if (!data) {
+      ok = false;
+      break;
+    }
+    apply(*data, capture.pixels, true);
+
+    if (frame > position) {
+      position++;
+    } else {
+      position--;
+    }
+  }
+
+  for (size_t t = 0; t < tiles.size(); t++) {
+    if (marked[t]) changed.push_back({tiles[t].x, tiles[t].y, tiles[t].width, tiles[t].height});
+  }
+
+  return ok;
+}
+
+bool Recorder::restore_latest(Capture& capture) {
+  if (!has_frames() || !same_layout(capture)) return false;
+  capture.expand();
+
+  std::copy(latest.begin(), latest.end(), capture.pixels);
+  position = deltas.size();
+  return true;
+}
+
+const std::vector<uint8_t>* Recorder::load(const Delta& delta) {
+  if (!delta.spilled) return &delta.data;
+
+  loaded.resize(delta.file_size);
+  if (seek_file(spill, delta.offset) != 0 || fread(loaded.data(), 1, loaded.size(), spill) != loaded.size()) {
+    SDL_Log("Failed to read recording spill file: '%s'", options.spill_path.c_str());
+    return nullptr;
+  }
+  return &loaded;
+}
+
+void Recorder::apply(const std::vector<uint8_t>& data, RGB* pixels, bool mark) {
+  const uint8_t* p   = data.data();
+  const uint8_t* end = p + data.size();
+  while (p < end) {
+    uint32_t t    = get_u32(p);
+    uint32_t size = get_u32(p + 4);
+    p += 8;
+
+    const Tile& tile            = tiles[t];
+    const CaptureRegion& region = regions[tile.region];
+    size_t row_bytes            = (size_t)tile.width * sizeof(RGB);
+    size_t first                = region.offset + (size_t)(tile.y - region.y) * region.width + (tile.x - region.x);
+
+    scratch.resize(row_bytes * tile.height);
+    rle_decode(p, size, scratch.data(), scratch.size());
+    p += size;
+
+    for (int row = 0; row < tile.height; row++) {
+      uint8_t* dst      = (uint8_t*)(pixels + first + (size_t)row * region.width);
+      const uint8_t* in = scratch.data() + row * row_bytes;
+      for (size_t i = 0; i < row_bytes; i++) dst[i] ^= in[i];
+    }
+
+    if (mark) marked[t] = 1;
+  }
+}
+
+// Folds the oldest delta into the base frame, the recording then starts one
+// frame later. A delta that can't be read back would leave the base frame
+// wrong, the recording is stopped instead and keeps what it has.
+bool Recorder::evict_oldest() {
+  Delta& delta = deltas.front();
+
+  const std::vector<uint8_t>* data = load(delta);
+  if (!data) {
+    SDL_Log("Stopping the recording, its oldest frame can't be dropped");
+    recording = false;
+    return false;
+  }
+  apply(*data, base.data(), false);
+
+  if (delta.spilled) {
+    spill_release(delta.offset, delta.file_size);
+  } else {
+    memory -= delta.data.size();
+  }
+
+  deltas.pop_front();
+  if (position > 0) position--;
+  return true;
+}
+
+// Moves the oldest delta still in memory to the spill file.
+bool Recorder::spill_oldest() {
+  if (!spill) return false;
+
+  auto it = std::find_if(deltas.begin(), deltas.end(), [](const Delta& d) { return !d.spilled; });
+  if (it == deltas.end()) return false;
+
+  Delta& delta    = *it;
+  uint64_t offset = spill_allocate(delta.data.size());
+  if (seek_file(spill, offset) != 0 || fwrite(delta.data.data(), 1, delta.data.size(), spill) != delta.data.size()) {
+    SDL_Log("Failed to write recording spill file: '%s', dropping the oldest frame instead", options.spill_path.c_str());
+    spill_release(offset, delta.data.size());
+    return false;
+  }
+
+  delta.spilled   = true;
+  delta.offset    = offset;
+  delta.file_size = (uint32_t)delta.data.size();
+  memory -= delta.data.size();
+  delta.data = {};
+  return true;
+}
+
+// Where to write size bytes into the spill file: the first unused extent
+// they fit into, or the end. The file only grows as far as the spilled
+// deltas alive at the same time need.
+uint64_t Recorder::spill_allocate(uint64_t size) {
+  for (auto it = spill_free.begin(); it != spill_free.end(); ++it) {
+    if (it->second < size) continue;
+    uint64_t offset = it->first;
+    it->first += size;
+    it->second -= size;
+    if (it->second == 0) spill_free.erase(it);
+    return offset;
+  }
+
+  uint64_t offset = spill_end;
+  spill_end += size;
+  return offset;
+}
+
+// Marks an extent of the spill file as unused, merging it with its
+// neighbors. Unused space at the end shrinks spill_end instead.
+void Recorder::spill_release(uint64_t offset, uint64_t size) {
+  if (size == 0) return;
+
+  auto next = std::lower_bound(spill_free.begin(), spill_free.end(), std::make_pair(offset, (uint64_t)0));
+  if (next != spill_free.end() && offset + size == next->first) {
+    size += next->second;
+    next = spill_free.erase(next);
+  }
+  if (next != spill_free.begin() && (next - 1)->first + (next - 1)->second == offset) {
+    offset = (next - 1)->first;
+    size += (next - 1)->second;
+    next = spill_free.erase(next - 1);
+  }
+
+  if (offset + size == spill_end) {
+    spill_end = offset;
+  } else {
+    spill_free.insert(next, {offset, size});
+  }
+}
+
+// Spilled deltas take no memory, so they are never dropped for the budget.
+// Without a spill file the oldest frames are dropped until the deltas fit.
+void Recorder::enforce_limits() {
+  while (frame_count() > std::max<size_t>(options.max_frames, 1)) {
+    if (!evict_oldest()) return;
+  }
+
+  while (memory > options.memory_budget && !deltas.empty()) {
+    if (spill_oldest()) continue;
+    if (deltas.front().spilled || !evict_oldest()) return;
+  }
+}
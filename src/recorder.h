@@ -0,0 +1,125 @@
+#ifndef _RECORDER_H_
+#define _RECORDER_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "SDL3/SDL.h"
+
+#include "capture.h"
+
+struct RecorderOptions {
+  size_t max_frames = 600;
+  // for the deltas kept in memory. The first and the newest frame are kept
+  // in full on top of it.
+  size_t memory_budget = 256 * 1024 * 1024;
+  // when set, deltas that don't fit into the memory budget are moved to this
+  // file instead of dropping the oldest frames.
+  std::string spill_path;
+};
+
+// Records successive states of a capture. The first frame is kept in full,
+// every following frame only as the tiles that changed, XORed with their
+// previous content and run length encoded. XOR deltas undo themselves, so the
+// same delta steps forward and backward through the recording.
+class Recorder {
+public:
+  ~Recorder();
+
+  bool start(const Capture& capture, const RecorderOptions& options);
+  void stop();
+  void clear();
+
+  bool is_recording() const {
+    return recording;
+  }
+
+  bool has_frames() const {
+    return !base.empty();
+  }
+
+  // Total number of frames, including the first full one.
+  size_t frame_count() const {
+    return base.empty() ? 0 : deltas.size() + 1;
+  }
+
+  // Index of the frame Capture::pixels currently shows.
+  size_t current_frame() const {
+    return position;
+  }
+
+  // the full frames and the deltas in memory
+  size_t memory_used() const {
+    return (base.size() + latest.size()) * sizeof(RGB) + memory;
+  }
+
+  // Adds the current state of capture as a new frame. dirty limits the
+  // compared area to the given rectangles (world coordinates), nullptr
+  // compares everything. Capture::pixels must show the last frame.
+  bool push(const Capture& capture, const std::vector<SDL_Rect>* dirty);
+
+  // Rewrites capture.pixels to show the given frame and appends the
+  // rectangles that changed to changed.
+  bool seek(Capture& capture, size_t frame, std::vector<SDL_Rect>& changed);
+
+  // Copies the newest frame into capture.pixels, for when the capture changed
+  // without being recorded. The textures must be uploaded again afterwards.
+  bool restore_latest(Capture& capture);
+
+private:
+  struct Tile {
+    int region;
+    int x;
+    int y;
+    int width;
+    int height;
+  };
+
+  struct Delta {
+    std::vector<uint8_t> data; // [u32 tile][u32 size][size rle bytes]...
+    bool spilled       = false;
+    uint64_t offset    = 0;
+    uint32_t file_size = 0;
+  };
+
+  static constexpr int tile_size = 64;
+
+  bool same_layout(const Capture& capture) const;
+  void mark_tiles(const SDL_Rect& rect);
+  const std::vector<uint8_t>* load(const Delta& delta);
+  void apply(const std::vector<uint8_t>& data, RGB* pixels, bool mark);
+  bool evict_oldest();
+  bool spill_oldest();
+  uint64_t spill_allocate(uint64_t size);
+  void spill_release(uint64_t offset, uint64_t size);
+  void enforce_limits();
+
+  std::vector<CaptureRegion> regions;
+  std::vector<size_t> region_first_tile;
+  std::vector<Tile> tiles;
+  std::vector<char> marked;
+  size_t pixel_count = 0;
+
+  std::vector<RGB> base;   // the oldest frame
+  std::vector<RGB> latest; // the newest frame
+  std::deque<Delta> deltas; // deltas[i] turns frame i into frame i + 1
+  size_t position = 0;
+  size_t memory   = 0; // of the deltas in memory
+
+  RecorderOptions options;
+  bool recording     = false;
+  FILE* spill        = nullptr;
+  uint64_t spill_end = 0;
+  // unused extents of the spill file before spill_end, by offset: offset, size
+  std::vector<std::pair<uint64_t, uint64_t>> spill_free;
+
+  std::vector<uint8_t> scratch;
+  std::vector<uint8_t> encoded;
+  std::vector<uint8_t> loaded;
+};
+
+#endif
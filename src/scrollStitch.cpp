@@ -0,0 +1,118 @@
+#include "scrollStitch.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+// a shift is only trusted when at least this many rows, or a quarter of the
+// moving band, overlap. Shorter overlaps match by accident too easily.
+static constexpr int min_overlap_rows = 16;
+
+static constexpr uint64_t rolling_base = 0x100000001B3ull;
+
+static uint64_t hash_row(const RGB* row, int width) {
+  const uint8_t* bytes = (const uint8_t*)row;
+  size_t size          = (size_t)width * sizeof(RGB);
+
+  uint64_t hash = 0xCBF29CE484222325ull;
+  size_t i      = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t word;
+    std::memcpy(&word, bytes + i, 8);
+    hash = (hash ^ word) * rolling_base;
+    hash ^= hash >> 29;
+  }
+  for (; i < size; i++) {
+    hash = (hash ^ bytes[i]) * rolling_base;
+  }
+  return hash;
+}
+
+// prefix[i] is the polynomial hash of values[0..i), so any range can be
+// hashed in constant time.
+static void prefix_hashes(const uint64_t* values, int count, std::vector<uint64_t>& prefix) {
+  prefix.resize(count + 1);
+  prefix[0] = 0;
+  for (int i = 0; i < count; i++) {
+    prefix[i + 1] = prefix[i] * rolling_base + values[i];
+  }
+}
+
+static uint64_t range_hash(const std::vector<uint64_t>& prefix, const std::vector<uint64_t>& powers, int begin, int end) {
+  return prefix[end] - prefix[begin] * powers[end - begin];
+}
+
+void ScrollStitcher::reset(int frame_width, int frame_height) {
+  width    = frame_width;
+  height   = frame_height;
+  position   = 0;
+  last_shift = 0;
+  pixels.clear();
+  last_hashes.clear();
+}
+
+int ScrollStitcher::add(const RGB* frame) {
+  hashes.resize(height);
+  for (int y = 0; y < height; y++) {
+    hashes[y] = hash_row(frame + (size_t)y * width, width);
+  }
+
+  if (pixels.empty()) {
+    pixels.assign(frame, frame + (size_t)width * height);
+    std::swap(last_hashes, hashes);
+    return height;
+  }
+
+  // rows that did not change at all are fixed parts around the scrolling area
+  int top = 0;
+  while (top < height && hashes[top] == last_hashes[top]) top++;
+  if (top == height) return 0;
+
+  int bottom = height;
+  while (bottom > top && hashes[bottom - 1] == last_hashes[bottom - 1]) bottom--;
+
+  int shift;
+  if (!find_shift(top, bottom, shift)) return -1;
+
+  // the last frame is at the end of pixels. Its fixed bottom rows are replaced
+  // by the rows that scrolled into view, followed by the fixed rows again.
+  pixels.resize((size_t)(position + bottom) * width);
+  pixels.insert(pixels.end(), frame + (size_t)(bottom - shift) * width, frame + (size_t)height * width);
+  position += shift;
+  last_shift = shift;
+
+  std::swap(last_hashes, hashes);
+  return shift;
+}
+
+// Finds the shift so that rows [top, bottom - shift) of the current frame are
+// rows [top + shift, bottom) of the last one, i.e. the content moved up by
+// shift rows. Repeating content, e.g. table rows of equal height, matches at
+// every multiple of its period. Scrolling keeps about its speed from frame to
+// frame, so the match closest to the last shift is taken, the smallest one
+// for the first frame.
+bool ScrollStitcher::find_shift(int top, int bottom, int& shift) const {
+  int band        = bottom - top;
+  int min_overlap = std::max(min_overlap_rows, band / 4);
+  if (band <= min_overlap) return false;
+
+  std::vector<uint64_t> last_prefix, prefix, powers(band + 1);
+  prefix_hashes(last_hashes.data() + top, band, last_prefix);
+  prefix_hashes(hashes.data() + top, band, prefix);
+  powers[0] = 1;
+  for (int i = 1; i <= band; i++) powers[i] = powers[i - 1] * rolling_base;
+
+  bool found = false;
+  for (int s = 1; s <= band - min_overlap; s++) {
+    if (found && (last_shift == 0 || std::abs(s - last_shift) >= std::abs(shift - last_shift))) break;
+    if (range_hash(last_prefix, powers, s, band) != range_hash(prefix, powers, 0, band - s)) continue;
+
+    // confirm the candidate row by row, a rolling hash collision is unlikely
+    // but would tear the image apart.
+    if (std::equal(hashes.begin() + top, hashes.begin() + bottom - s, last_hashes.begin() + top + s)) {
+      shift = s;
+      found = true;
+    }
+  }
+  return found;
+}
@@ -0,0 +1,50 @@
+#ifndef _SCROLL_STITCH_H_
+#define _SCROLL_STITCH_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "capture.h"
+
+// Stitches successive frames of a scrolling area into one tall image. Every
+// frame is matched against the one before it: rows that stay put (toolbars,
+// headers) are skipped, and the vertical shift of the remaining band is found
+// by comparing rolling hashes over per-row hashes, so each frame costs about
+// one pass over its pixels no matter how tall the result already is.
+class ScrollStitcher {
+public:
+  void reset(int width, int height);
+
+  // Adds the next frame, width x height pixels with a stride of width.
+  // Returns the number of rows the image grew by, 0 when the frame did not
+  // scroll down and -1 when no overlap with the previous frame was found (e.g.
+  // scrolled by more than a screen). Such frames are dropped.
+  int add(const RGB* frame);
+
+  int get_width() const {
+    return width;
+  }
+
+  int get_height() const {
+    return width > 0 ? (int)(pixels.size() / width) : 0;
+  }
+
+  const std::vector<RGB>& get_pixels() const {
+    return pixels;
+  }
+
+private:
+  bool find_shift(int top, int bottom, int& shift) const;
+
+  int width  = 0;
+  int height = 0;
+
+  std::vector<RGB> pixels;
+  int position   = 0; // row of pixels the last frame starts at
+  int last_shift = 0; // how far the last frame scrolled, 0 before the first
+
+  std::vector<uint64_t> last_hashes; // row hashes of the last frame
+  std::vector<uint64_t> hashes;      // row hashes of the current frame
+};
+
+#endif
@@ -0,0 +1,84 @@
+#include "shmFrames.h"
+
+#include <atomic>
+#include <cstring>
+
+#if !_WIN32
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+ShmFrames::~ShmFrames() {
+  detach();
+}
+
+bool ShmFrames::attach(const std::string& shm_name) {
+  detach();
+
+#if _WIN32
+  return false;
+#else
+  int fd = shm_open(shm_name.c_str(), O_RDONLY, 0);
+  if (fd < 0) return false;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ShmFramesHeader)) {
+    close(fd);
+    return false;
+  }
+
+  void* memory = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (memory == MAP_FAILED) return false;
+
+  // the producer can still write to the header, only the copy is checked and
+  // used from here on
+  ShmFramesHeader h;
+  std::memcpy(&h, memory, sizeof(h));
+
+  uint64_t bytes_per_pixel = h.format == SHM_FRAMES_RGB24 ? 3 : h.format == SHM_FRAMES_GRAY8 ? 1 : 4;
+  uint64_t frame_size      = (uint64_t)h.pitch * h.height;
+  uint64_t slots_size, end;
+  bool valid = h.magic == shm_frames_magic && h.version == shm_frames_version &&
+               h.format <= SHM_FRAMES_GRAY8 && h.width > 0 && h.height > 0 && h.slot_count > 0 &&
+               h.pitch >= h.width * bytes_per_pixel && h.slot_size >= frame_size &&
+               h.header_size >= sizeof(ShmFramesHeader) &&
+               !__builtin_mul_overflow(h.slot_size, (uint64_t)h.slot_count, &slots_size) &&
+               !__builtin_add_overflow(slots_size, (uint64_t)h.header_size, &end) && end <= (uint64_t)st.st_size;
+  if (!valid) {
+    munmap(memory, st.st_size);
+    return false;
+  }
+
+  header = h;
+  mapped = (const uint8_t*)memory;
+  name   = shm_name;
+  size   = st.st_size;
+  return true;
+#endif
+}
+
+void ShmFrames::detach() {
+#if !_WIN32
+  if (mapped) munmap((void*)mapped, size);
+#endif
+  mapped = nullptr;
+  header = {};
+  size   = 0;
+  name.clear();
+}
+
+uint64_t ShmFrames::latest() const {
+  if (!mapped) return 0;
+  // pairs with the producer's release store, the frame's pixels are visible
+  // once its sequence number is.
+  uint64_t& sequence = const_cast<ShmFramesHeader*>((const ShmFramesHeader*)mapped)->sequence;
+  return std::atomic_ref<uint64_t>(sequence).load(std::memory_order_acquire);
+}
+
+const uint8_t* ShmFrames::frame(uint64_t sequence) const {
+  if (!mapped || sequence == 0) return nullptr;
+  return mapped + header.header_size + (sequence % header.slot_count) * header.slot_size;
+}
@@ -0,0 +1,84 @@
+#ifndef _SHM_FRAMES_H_
+#define _SHM_FRAMES_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+
+// Layout of a POSIX shared memory object that other processes write frames
+// into. The object starts with a ShmFramesHeader, followed by slot_count slots
+// of slot_size bytes at header_size. Frame n (counting from 1) is written into
+// slot n % slot_count, once it is complete the producer stores n into sequence
+// with release semantics. Geometry and format are fixed for the lifetime of
+// the object. A producer should use at least 3 slots, so the frame cappy is
+// looking at isn't overwritten while it is uploaded.
+static constexpr uint32_t shm_frames_magic   = 0x59505043; // "CPPY"
+static constexpr uint32_t shm_frames_version = 1;
+
+enum ShmFramesFormat : uint32_t {
+  SHM_FRAMES_RGB24  = 0,
+  SHM_FRAMES_BGRX32 = 1,
+  SHM_FRAMES_RGBA32 = 2,
+  SHM_FRAMES_GRAY8  = 3,
+};
+
+struct ShmFramesHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t width;
+  uint32_t height;
+  uint32_t format;      // ShmFramesFormat
+  uint32_t pitch;       // bytes between two rows
+  uint32_t slot_count;
+  uint32_t header_size; // offset of the first slot
+  uint64_t slot_size;   // bytes between two slots
+  uint64_t sequence;    // last complete frame, 0 before the first one
+};
+
+// Read only view of a frame ring written by another process. The header is
+// copied and checked once when attaching, later changes by the producer to
+// anything but sequence are ignored.
+class ShmFrames {
+public:
+  ShmFrames() = default;
+  ~ShmFrames();
+
+  ShmFrames(const ShmFrames&)            = delete;
+  ShmFrames& operator=(const ShmFrames&) = delete;
+
+  bool attach(const std::string& name);
+  void detach();
+
+  bool is_attached() const {
+    return mapped != nullptr;
+  }
+
+  void swap(ShmFrames& other) {
+    std::swap(header, other.header);
+    std::swap(mapped, other.mapped);
+    std::swap(name, other.name);
+    std::swap(size, other.size);
+  }
+
+  const std::string& get_name() const {
+    return name;
+  }
+
+  // Sequence number of the newest complete frame, 0 when there is none yet.
+  uint64_t latest() const;
+
+  // Pixels of the given frame, valid until the producer wraps around to its
+  // slot again.
+  const uint8_t* frame(uint64_t sequence) const;
+
+  // as it was when attaching, sequence excepted
+  ShmFramesHeader header = {};
+
+private:
+  const uint8_t* mapped = nullptr;
+  std::string name;
+  size_t size = 0;
+};
+
+#endif
@@ -1,6 +1,7 @@
 #include "colorState.h"
 #include "moveState.h"
 
+#include <algorithm>
 #include <cmath>
 #include <format>
 
@@ -100,17 +101,34 @@ void ColorState::draw_frame(std::shared_ptr<CappyMachine> machine) {
       SDL_ShowCursor();
     }
 
+    // in live mode the pixel under the mouse can change without the mouse moving
+    if (rgb.r != shown_rgb.r || rgb.g != shown_rgb.g || rgb.b != shown_rgb.b) {
+      recompute_text = true;
+    }
+
     if (recompute_text) {
-      std::string text = std::format("r: {:3} g: {:3} b: {:3}\nx: {} y: {}", rgb.r, rgb.g, rgb.b, (int)mouse.x, (int)mouse.y);
+      shown_rgb = rgb;
+      std::string text;
+      RGB16 deep;
+      if (capture.depth > 8 && capture.at16(mouse.x, mouse.y, deep)) {
+        // the values as the source stored them, e.g. 0-1023 for 10 bits
+        int shift = 16 - capture.depth;
+        text      = std::format("r: {:5} g: {:5} b: {:5}\nx: {} y: {} ({} bit)", deep.r >> shift, deep.g >> shift, deep.b >> shift, (int)mouse.x, (int)mouse.y, capture.depth);
+      } else {
+        text = std::format("r: {:3} g: {:3} b: {:3}\nx: {} y: {}", rgb.r, rgb.g, rgb.b, (int)mouse.x, (int)mouse.y);
+      }
       text_surface     = std::shared_ptr<SDL_Surface>(TTF_RenderText_Solid_Wrapped(machine->get_font(), text.c_str(), {255, 255, 255, 255}, 0), SDL_DestroySurface);
       text_texture     = std::shared_ptr<SDL_Texture>(SDL_CreateTextureFromSurface(machine->get_renderer().get(), text_surface.get()), SDL_DestroyTexture);
       recompute_text   = false;
     }
 
+    // 16 bit values need a wider panel than the usual 8 bit ones
+    float width = std::max(panel_width, text_surface->w + 10.0f);
+
     SDL_FRect text_panel = {
         mx,
         my - text_surface->h - 1,
-        panel_width,
+        width,
         (float)text_surface->h,
     };
     text_panel.x += panel_offset;
@@ -124,8 +142,8 @@ void ColorState::draw_frame(std::shared_ptr<CappyMachine> machine) {
     SDL_FRect color_panel = {
         mx,
         my - text_panel.w - text_surface->h,
-        panel_width,
-        panel_width,
+        width,
+        width,
     };
     color_panel.x += panel_offset;
     color_panel.y -= panel_offset;
@@ -137,7 +155,7 @@ void ColorState::draw_frame(std::shared_ptr<CappyMachine> machine) {
     SDL_RenderRect(machine->get_renderer().get(), &color_panel);
 
     SDL_FRect text_rect = {
-        mx + (0.5f * (panel_width - text_surface->w)),
+        mx + (0.5f * (width - text_surface->w)),
         my - text_surface->h - 1,
         (float)text_surface->w,
         (float)text_surface->h,
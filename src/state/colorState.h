@@ -14,6 +14,7 @@ private:
   std::shared_ptr<SDL_Surface> text_surface;
   std::shared_ptr<SDL_Texture> text_texture;
   bool recompute_text = true;
+  RGB shown_rgb       = {0, 0, 0};
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,121 @@
+#include "timelineState.h"
+#include "moveState.h"
+
+#include <algorithm>
+#include <format>
+
+bool TimelineState::handle_event(std::shared_ptr<CappyMachine> machine, SDL_Event& event) {
+  Recorder& recorder = machine->get_recorder();
+
+  switch (event.type) {
+    case SDL_EVENT_KEY_DOWN: {
+      SDL_Keycode code = event.key.keysym.sym;
+      if (code == SDLK_t) {
+        // main seeks back to the newest frame once the timeline is closed
+        machine->set_state<MoveState>();
+        return true;
+      } else if (code == SDLK_F5) {
+        // a recapture would replace the frame being looked at
+        return true;
+      } else if (code == SDLK_LEFT || code == SDLK_COMMA) {
+        if (recorder.current_frame() > 0) seek(machine, recorder.current_frame() - 1);
+        return true;
+      } else if (code == SDLK_RIGHT || code == SDLK_PERIOD) {
+        seek(machine, recorder.current_frame() + 1);
+        return true;
+      } else if (code == SDLK_HOME) {
+        seek(machine, 0);
+        return true;
+      } else if (code == SDLK_END) {
+        seek(machine, recorder.frame_count() - 1);
+        return true;
+      }
+      break;
+    }
+    case SDL_EVENT_MOUSE_BUTTON_DOWN: {
+      if (event.button.button == SDL_BUTTON_LEFT && seek_to_mouse(machine, event.button.x, event.button.y)) {
+        scrubbing = true;
+        return true;
+      }
+      break;
+    }
+    case SDL_EVENT_MOUSE_BUTTON_UP: {
+      if (event.button.button == SDL_BUTTON_LEFT && scrubbing) {
+        scrubbing = false;
+        return true;
+      }
+      break;
+    }
+    case SDL_EVENT_MOUSE_MOTION: {
+      if (scrubbing) {
+        seek_to_mouse(machine, event.motion.x, -1.0f);
+        return true;
+      }
+      break;
+    }
+  }
+  return false;
+}
+
+void TimelineState::draw_frame(std::shared_ptr<CappyMachine> machine) {
+  CameraSmooth& camera = machine->get_camera();
+  camera.update();
+
+  Recorder& recorder = machine->get_recorder();
+  SDL_Renderer* r    = machine->get_renderer().get();
+
+  int w, h;
+  SDL_GetCurrentRenderOutputSize(r, &w, &h);
+
+  SDL_FRect bar = {0.0f, h - bar_height, (float)w, bar_height};
+  SDL_SetRenderDrawColor(r, 0, 0, 0, 200);
+  SDL_RenderFillRect(r, &bar);
+
+  size_t count = recorder.frame_count();
+  if (count > 1) {
+    SDL_FRect progress = {bar.x, bar.y, bar.w * recorder.current_frame() / (count - 1), bar.h};
+    SDL_SetRenderDrawColor(r, 125, 125, 125, 200);
+    SDL_RenderFillRect(r, &progress);
+  }
+
+  if (recorder.current_frame() != shown_frame || count != shown_count) {
+    shown_frame      = recorder.current_frame();
+    shown_count      = count;
+    std::string text = std::format("frame {} / {}{}", shown_frame + 1, count, recorder.is_recording() ? " (recording)" : "");
+    text_surface     = std::shared_ptr<SDL_Surface>(TTF_RenderText_Solid(machine->get_font(), text.c_str(), {255, 255, 255, 255}), SDL_DestroySurface);
+    text_texture     = std::shared_ptr<SDL_Texture>(SDL_CreateTextureFromSurface(r, text_surface.get()), SDL_DestroyTexture);
+  }
+
+  if (text_surface) {
+    SDL_FRect text_rect = {
+        bar_padding,
+        bar.y + 0.5f * (bar.h - text_surface->h),
+        (float)text_surface->w,
+        (float)text_surface->h,
+    };
+    SDL_RenderTexture(r, text_texture.get(), NULL, &text_rect);
+  }
+}
+
+void TimelineState::seek(std::shared_ptr<CappyMachine> machine, size_t frame) {
+  std::vector<SDL_Rect> changed;
+  if (!machine->get_recorder().seek(machine->get_capture(), frame, changed)) {
+    SDL_Log("Failed to seek to frame %zu!", frame + 1);
+  }
+  machine->update_capture(changed);
+}
+
+// Seeks to the frame under x when the mouse is over the timeline bar, a
+// negative y skips the bar check while dragging.
+bool TimelineState::seek_to_mouse(std::shared_ptr<CappyMachine> machine, float x, float y) {
+  int w, h;
+  SDL_GetCurrentRenderOutputSize(machine->get_renderer().get(), &w, &h);
+  if (y >= 0.0f && y < h - bar_height) return false;
+
+  size_t count = machine->get_recorder().frame_count();
+  if (count == 0 || w <= 0) return true;
+
+  float t = std::clamp(x / w, 0.0f, 1.0f);
+  seek(machine, (size_t)(t * (count - 1) + 0.5f));
+  return true;
+}
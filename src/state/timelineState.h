@@ -0,0 +1,24 @@
+#ifndef _TIMELINE_STATE_H
+#define _TIMELINE_STATE_H
+
+#include "cappyMachine.h"
+
+DEFINE_STATE(TimelineState, CappyMachine) {
+  DEFINE_STATE_INNER(TimelineState, CappyMachine);
+
+public:
+private:
+  void seek(std::shared_ptr<CappyMachine> machine, size_t frame);
+  bool seek_to_mouse(std::shared_ptr<CappyMachine> machine, float x, float y);
+
+  float bar_height  = 50.0f;
+  float bar_padding = 10.0f;
+  bool scrubbing    = false;
+
+  std::shared_ptr<SDL_Surface> text_surface;
+  std::shared_ptr<SDL_Texture> text_texture;
+  size_t shown_frame = SIZE_MAX;
+  size_t shown_count = 0;
+};
+
+#endif
@@ -0,0 +1,169 @@
+#include "tilePyramid.h"
+#include "capture.h"
+#include "convert.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <vector>
+
+static constexpr uint32_t pyramid_magic   = 0x50595043; // "CPYP"
+static constexpr uint32_t pyramid_version = 1;
+
+static int level_size(int size, int level) {
+  return (size + (1 << level) - 1) >> level;
+}
+
+// Bytes from the start of a level of width lw and height lh to tile tx, ty.
+// All tile rows but the last are tile_size high and all tiles of a row but
+// the last are tile_size wide.
+static size_t tile_offset(int lw, int lh, int tx, int ty) {
+  constexpr int t = TilePyramid::tile_size;
+  int th          = std::min(t, lh - ty * t);
+  return ((size_t)ty * t * lw + (size_t)tx * t * th) * sizeof(RGB);
+}
+
+// Copies rows y to y + h of a level, given its first byte, into dst.
+static void read_level_rows(const uint8_t* level, int lw, int lh, int y, int h, RGB* dst) {
+  constexpr int t = TilePyramid::tile_size;
+  for (int row = y; row < y + h; row++) {
+    int ty = row / t;
+    for (int tx = 0; tx * t < lw; tx++) {
+      int tw          = std::min(t, lw - tx * t);
+      const RGB* tile = (const RGB*)(level + tile_offset(lw, lh, tx, ty));
+      std::copy(tile + (size_t)(row - ty * t) * tw, tile + (size_t)(row - ty * t + 1) * tw, dst + (size_t)(row - y) * lw + tx * t);
+    }
+  }
+}
+
+// Writes h rows of width w, one band of tiles, tile by tile.
+static bool write_band(std::FILE* f, const RGB* band, int w, int h) {
+  constexpr int t = TilePyramid::tile_size;
+  for (int tx = 0; tx * t < w; tx++) {
+    int tw = std::min(t, w - tx * t);
+    for (int row = 0; row < h; row++) {
+      if (std::fwrite(band + (size_t)row * w + tx * t, sizeof(RGB), tw, f) != (size_t)tw) return false;
+    }
+  }
+  return true;
+}
+
+bool TilePyramid::build(const std::string& path, int width, int height, uint64_t source_size, int64_t source_time, const std::function<void(int y, int h, RGB* dst)>& read_rows) {
+  if (width <= 0 || height <= 0) return false;
+
+  TilePyramidHeader header = {};
+  header.magic             = pyramid_magic;
+  header.version           = pyramid_version;
+  header.source_size       = source_size;
+  header.source_time       = source_time;
+  header.width             = width;
+  header.height            = height;
+  header.tile_size         = tile_size;
+  header.levels            = 1;
+  while (std::max(level_size(width, header.levels - 1), level_size(height, header.levels - 1)) > tile_size && header.levels < 32) {
+    header.levels++;
+  }
+
+  uint64_t offset = sizeof(header);
+  for (uint32_t level = 0; level < header.levels; level++) {
+    header.level_offset[level] = offset;
+    offset += (uint64_t)level_size(width, level) * level_size(height, level) * sizeof(RGB);
+  }
+
+  // written next to the cache file and renamed once complete, so a build
+  // that is cut short is never opened
+  std::string part = path + ".part";
+  std::FILE* f     = std::fopen(part.c_str(), "wb");
+  if (!f) return false;
+
+  bool ok = std::fwrite(&header, sizeof(header), 1, f) == 1;
+
+  std::vector<RGB> band((size_t)width * tile_size);
+  for (int y = 0; ok && y < height; y += tile_size) {
+    int h = std::min(tile_size, height - y);
+    read_rows(y, h, band.data());
+    ok = write_band(f, band.data(), width, h);
+  }
+
+  // every level is the one below averaged over 2x2 pixels, read back from
+  // what was written so far
+  std::vector<RGB> below;
+  for (uint32_t level = 1; ok && level < header.levels; level++) {
+    ok = std::fflush(f) == 0;
+
+    MappedFile written;
+    if (!ok || !written.open(part.c_str())) {
+      ok = false;
+      break;
+    }
+
+    int bw               = level_size(width, level - 1);
+    int bh               = level_size(height, level - 1);
+    int lw               = level_size(width, level);
+    int lh               = level_size(height, level);
+    const uint8_t* start = written.data + header.level_offset[level - 1];
+
+    below.resize((size_t)bw * 2 * tile_size);
+    for (int y = 0; ok && y < lh; y += tile_size) {
+      int h    = std::min(tile_size, lh - y);
+      int rows = std::min(2 * h, bh - 2 * y);
+      read_level_rows(start, bw, bh, 2 * y, rows, below.data());
+
+      downsample_rgb(below.data(), bw, band.data(), lw, bw, rows);
+      ok = write_band(f, band.data(), lw, h);
+    }
+  }
+
+  ok = std::fclose(f) == 0 && ok;
+
+  std::error_code error;
+  if (ok) {
+    std::filesystem::remove(path, error);
+    std::filesystem::rename(part, path, error);
+    ok = !error;
+  }
+  if (!ok) std::filesystem::remove(part, error);
+  return ok;
+}
+
+bool TilePyramid::open(const std::string& path, uint64_t source_size, int64_t source_time) {
+  close();
+
+  if (!file.open(path.c_str())) return false;
+  if (file.size < sizeof(TilePyramidHeader)) {
+    close();
+    return false;
+  }
+
+  const TilePyramidHeader* h = (const TilePyramidHeader*)file.data;
+  bool valid                 = h->magic == pyramid_magic && h->version == pyramid_version && h->source_size == source_size && h->source_time == source_time &&
+               h->tile_size == (uint32_t)tile_size && h->levels >= 1 && h->levels <= 32 && h->width > 0 && h->height > 0;
+  if (valid) {
+    int last = h->levels - 1;
+    valid    = h->level_offset[last] + (uint64_t)level_size(h->width, last) * level_size(h->height, last) * sizeof(RGB) <= file.size;
+  }
+  if (!valid) {
+    close();
+    return false;
+  }
+
+  header = h;
+  return true;
+}
+
+void TilePyramid::close() {
+  file.close();
+  header = nullptr;
+}
+
+int TilePyramid::tile_width(int level, int tx) const {
+  return std::min(tile_size, level_width(level) - tx * tile_size);
+}
+
+int TilePyramid::tile_height(int level, int ty) const {
+  return std::min(tile_size, level_height(level) - ty * tile_size);
+}
+
+const RGB* TilePyramid::tile(int level, int tx, int ty) const {
+  return (const RGB*)(file.data + header->level_offset[level] + tile_offset(level_width(level), level_height(level), tx, ty));
+}
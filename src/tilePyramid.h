@@ -0,0 +1,92 @@
+#ifndef _TILE_PYRAMID_H_
+#define _TILE_PYRAMID_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <utility>
+
+#include "mappedFile.h"
+
+struct RGB;
+
+// Header of a tile pyramid cache file. Level 0 is the image itself, every
+// further level halves the one before until it fits into a single tile. The
+// tiles of a level are stored row by row, each tile as its own RGB rows, so
+// edge tiles are narrower or shorter than tile_size.
+struct TilePyramidHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t source_size; // the file the pyramid was built from, it is built
+  int64_t source_time;  // again when either changed
+  uint32_t width;
+  uint32_t height;
+  uint32_t tile_size;
+  uint32_t levels;
+  uint64_t level_offset[32]; // bytes from the start of the file
+};
+
+// A multi-resolution, tiled copy of an image too large to hold in memory or
+// in one texture. The cache file is mapped, only the tiles that are looked
+// at get read from disk.
+class TilePyramid {
+public:
+  static constexpr int tile_size = 256;
+
+  TilePyramid() = default;
+
+  TilePyramid(const TilePyramid&)            = delete;
+  TilePyramid& operator=(const TilePyramid&) = delete;
+
+  // Writes the pyramid of a width x height image into path. read_rows copies
+  // h rows starting at y into dst, which is width pixels wide. The levels
+  // are built from the level below, so the source is read only once.
+  static bool build(const std::string& path, int width, int height, uint64_t source_size, int64_t source_time, const std::function<void(int y, int h, RGB* dst)>& read_rows);
+
+  // Maps a pyramid built from a source of this size and time.
+  bool open(const std::string& path, uint64_t source_size, int64_t source_time);
+  void close();
+
+  bool is_open() const {
+    return header != nullptr;
+  }
+
+  void swap(TilePyramid& other) {
+    file.swap(other.file);
+    std::swap(header, other.header);
+  }
+
+  int get_levels() const {
+    return header->levels;
+  }
+
+  int level_width(int level) const {
+    return (header->width + (1 << level) - 1) >> level;
+  }
+
+  int level_height(int level) const {
+    return (header->height + (1 << level) - 1) >> level;
+  }
+
+  int tiles_x(int level) const {
+    return (level_width(level) + tile_size - 1) / tile_size;
+  }
+
+  int tiles_y(int level) const {
+    return (level_height(level) + tile_size - 1) / tile_size;
+  }
+
+  // Size of a tile in pixels of its level.
+  int tile_width(int level, int tx) const;
+  int tile_height(int level, int ty) const;
+
+  // The pixels of a tile, its rows are tile_width(level, tx) pixels apart.
+  const RGB* tile(int level, int tx, int ty) const;
+
+private:
+  MappedFile file;
+  const TilePyramidHeader* header = nullptr;
+};
+
+#endif
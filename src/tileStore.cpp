@@ -0,0 +1,315 @@
+#include "tileStore.h"
+#include "capture.h"
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <thread>
+
+// The codec follows QOI without alpha: every pixel is a run of the one
+// before, an index into the 64 colors seen last, a small difference to the
+// pixel before or, failing all of those, the full color. Each tile starts
+// over, so any tile can be decoded on its own.
+static constexpr uint8_t op_index = 0x00;
+static constexpr uint8_t op_diff  = 0x40;
+static constexpr uint8_t op_luma  = 0x80;
+static constexpr uint8_t op_run   = 0xc0;
+static constexpr uint8_t op_rgb   = 0xfe;
+static constexpr int max_run      = 62; // 0xfe and 0xff are not runs
+
+static int color_hash(const RGB& c) {
+  return (c.r * 3 + c.g * 5 + c.b * 7) % 64;
+}
+
+static bool same_color(const RGB& a, const RGB& b) {
+  return a.r == b.r && a.g == b.g && a.b == b.b;
+}
+
+static void encode_tile(const RGB* src, int stride, int w, int h, std::vector<uint8_t>& out) {
+  RGB index[64] = {};
+  RGB prev      = {0, 0, 0};
+  int run       = 0;
+
+  for (int y = 0; y < h; y++) {
+    const RGB* row = src + (size_t)y * stride;
+    for (int x = 0; x < w; x++) {
+      RGB px = row[x];
+      if (same_color(px, prev)) {
+        if (++run == max_run) {
+          out.push_back(op_run | (run - 1));
+          run = 0;
+        }
+        continue;
+      }
+      if (run > 0) {
+        out.push_back(op_run | (run - 1));
+        run = 0;
+      }
+
+      int hash = color_hash(px);
+      if (same_color(index[hash], px)) {
+        out.push_back(op_index | hash);
+        prev = px;
+        continue;
+      }
+      index[hash] = px;
+
+      // differences wrap around like the decoder's 8 bit additions
+      int dr    = (int8_t)(px.r - prev.r);
+      int dg    = (int8_t)(px.g - prev.g);
+      int db    = (int8_t)(px.b - prev.b);
+      int dr_dg = dr - dg;
+      int db_dg = db - dg;
+      if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+        out.push_back(op_diff | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+      } else if (dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 && db_dg >= -8 && db_dg <= 7) {
+        out.push_back(op_luma | (dg + 32));
+        out.push_back((dr_dg + 8) << 4 | (db_dg + 8));
+      } else {
+        out.push_back(op_rgb);
+        out.push_back(px.r);
+        out.push_back(px.g);
+        out.push_back(px.b);
+      }
+      prev = px;
+    }
+  }
+  if (run > 0) out.push_back(op_run | (run - 1));
+}
+
+static void decode_tile(const uint8_t* in, RGB* dst, int stride, int w, int h) {
+  RGB index[64] = {};
+  RGB px        = {0, 0, 0};
+  int run       = 0;
+
+  for (int y = 0; y < h; y++) {
+    RGB* row = dst + (size_t)y * stride;
+    for (int x = 0; x < w; x++) {
+      if (run > 0) {
+        run--;
+      } else {
+        uint8_t op = *in++;
+        if (op == op_rgb) {
+          px = {in[0], in[1], in[2]};
+          in += 3;
+        } else if ((op & 0xc0) == op_index) {
+          px = index[op];
+        } else if ((op & 0xc0) == op_diff) {
+          px.r += ((op >> 4) & 3) - 2;
+          px.g += ((op >> 2) & 3) - 2;
+          px.b += (op & 3) - 2;
+        } else if ((op & 0xc0) == op_luma) {
+          uint8_t next = *in++;
+          int dg       = (op & 0x3f) - 32;
+          px.r += dg - 8 + (next >> 4);
+          px.g += dg;
+          px.b += dg - 8 + (next & 0x0f);
+        } else {
+          run = op & 0x3f;
+        }
+        index[color_hash(px)] = px;
+      }
+      row[x] = px;
+    }
+  }
+}
+
+// Runs work(tile) for every tile on up to one thread per core.
+static void for_each_tile(size_t count, const std::function<void(size_t tile)>& work) {
+  std::atomic<size_t> next = 0;
+  auto run                 = [&]() {
+    for (size_t tile = next++; tile < count; tile = next++) {
+      work(tile);
+    }
+  };
+
+  size_t threads = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), count);
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < threads; i++) {
+    workers.emplace_back(run);
+  }
+  run();
+  for (std::thread& worker : workers) {
+    worker.join();
+  }
+}
+
+TileStore::TileStore() = default;
+
+TileStore::~TileStore() = default;
+
+void TileStore::compress(const std::vector<CaptureRegion>& regions, const RGB* pixels) {
+  begin(regions);
+
+  size_t count = tile_count();
+  std::vector<std::vector<uint8_t>> tiles(count);
+  for_each_tile(count, [&](size_t tile) {
+    const Grid* grid;
+    int tx, ty;
+    locate(tile, grid, tx, ty);
+    int w = std::min(tile_size, grid->width - tx * tile_size);
+    int h = std::min(tile_size, grid->height - ty * tile_size);
+    encode_tile(pixels + grid->offset + (size_t)ty * tile_size * grid->width + tx * tile_size, grid->width, w, h, tiles[tile]);
+  });
+
+  for (std::vector<uint8_t>& tile : tiles) {
+    offsets.push_back(data.size());
+    data.insert(data.end(), tile.begin(), tile.end());
+    tile = {};
+  }
+  offsets.push_back(data.size());
+  data.shrink_to_fit();
+
+  slot_of.assign(count, -1);
+}
+
+void TileStore::begin(const std::vector<CaptureRegion>& regions) {
+  clear();
+
+  size_t count = 0;
+  for (const CaptureRegion& region : regions) {
+    int tiles_x = (region.width + tile_size - 1) / tile_size;
+    int tiles_y = (region.height + tile_size - 1) / tile_size;
+    grids.push_back({count, region.offset, region.width, region.height, tiles_x});
+    count += (size_t)tiles_x * tiles_y;
+  }
+  offsets.reserve(count + 1);
+}
+
+// Tiles are appended to data in order on the calling thread, offsets holds
+// one entry per tile done until the end is added.
+bool TileStore::compress_next(const RGB* pixels, size_t count) {
+  size_t total = tile_count();
+  for (size_t done = 0; done < count && offsets.size() < total; done++) {
+    const Grid* grid;
+    int tx, ty;
+    locate(offsets.size(), grid, tx, ty);
+    int w = std::min(tile_size, grid->width - tx * tile_size);
+    int h = std::min(tile_size, grid->height - ty * tile_size);
+    offsets.push_back(data.size());
+    encode_tile(pixels + grid->offset + (size_t)ty * tile_size * grid->width + tx * tile_size, grid->width, w, h, data);
+  }
+  if (offsets.size() < total) return true;
+
+  offsets.push_back(data.size());
+  data.shrink_to_fit();
+  slot_of.assign(total, -1);
+  return false;
+}
+
+void TileStore::decompress(RGB* pixels) const {
+  for_each_tile(offsets.empty() ? 0 : offsets.size() - 1, [&](size_t tile) {
+    const Grid* grid;
+    int tx, ty;
+    locate(tile, grid, tx, ty);
+    int w = std::min(tile_size, grid->width - tx * tile_size);
+    int h = std::min(tile_size, grid->height - ty * tile_size);
+    decode_tile(data.data() + offsets[tile], pixels + grid->offset + (size_t)ty * tile_size * grid->width + tx * tile_size, grid->width, w, h);
+  });
+}
+
+void TileStore::clear() {
+  grids   = {};
+  data    = {};
+  offsets = {};
+  slots   = {};
+  slot_of = {};
+  clock   = 0;
+}
+
+void TileStore::swap(TileStore& other) {
+  std::swap(grids, other.grids);
+  std::swap(data, other.data);
+  std::swap(offsets, other.offsets);
+  std::swap(slots, other.slots);
+  std::swap(slot_of, other.slot_of);
+  std::swap(clock, other.clock);
+}
+
+RGB TileStore::at(size_t region, int x, int y) const {
+  const Grid& grid = grids[region];
+  int tx           = x / tile_size;
+  int ty           = y / tile_size;
+  const Slot& slot = cached(grid, tx, ty);
+  return slot.pixels[(size_t)(y - ty * tile_size) * slot.width + (x - tx * tile_size)];
+}
+
+void TileStore::read(size_t region, int x, int y, int w, int h, RGB* dst, int dst_stride) const {
+  const Grid& grid = grids[region];
+  std::vector<RGB> scratch;
+
+  for (int ty = y / tile_size; ty * tile_size < y + h; ty++) {
+    int tile_y = ty * tile_size;
+    int tile_h = std::min(tile_size, grid.height - tile_y);
+    int y1     = std::max(y, tile_y);
+    int y2     = std::min(y + h, tile_y + tile_h);
+
+    for (int tx = x / tile_size; tx * tile_size < x + w; tx++) {
+      int tile_x = tx * tile_size;
+      int tile_w = std::min(tile_size, grid.width - tile_x);
+      int x1     = std::max(x, tile_x);
+      int x2     = std::min(x + w, tile_x + tile_w);
+      RGB* out   = dst + (size_t)(y1 - y) * dst_stride + (x1 - x);
+
+      size_t tile    = grid.first + (size_t)ty * grid.tiles_x + tx;
+      const RGB* src = nullptr;
+      int src_stride = tile_w;
+      if (slot_of[tile] >= 0) {
+        src = slots[slot_of[tile]].pixels.data();
+      } else if (x1 == tile_x && x2 == tile_x + tile_w && y1 == tile_y && y2 == tile_y + tile_h) {
+        decode_tile(data.data() + offsets[tile], out, dst_stride, tile_w, tile_h);
+        continue;
+      } else {
+        scratch.resize((size_t)tile_size * tile_size);
+        decode_tile(data.data() + offsets[tile], scratch.data(), tile_w, tile_w, tile_h);
+        src = scratch.data();
+      }
+
+      for (int row = y1; row < y2; row++) {
+        const RGB* from = src + (size_t)(row - tile_y) * src_stride + (x1 - tile_x);
+        std::copy(from, from + (x2 - x1), out + (size_t)(row - y1) * dst_stride);
+      }
+    }
+  }
+}
+
+// The decompressed tile tx, ty of grid. A tile that is not cached is
+// decoded into the slot used least recently.
+const TileStore::Slot& TileStore::cached(const Grid& grid, int tx, int ty) const {
+  size_t tile = grid.first + (size_t)ty * grid.tiles_x + tx;
+  int index   = slot_of[tile];
+  if (index < 0) {
+    if (slots.size() < cached_tiles) {
+      index = (int)slots.size();
+      slots.push_back({0, 0, 0, std::vector<RGB>((size_t)tile_size * tile_size)});
+    } else {
+      auto oldest           = std::min_element(slots.begin(), slots.end(), [](const Slot& a, const Slot& b) { return a.last_used < b.last_used; });
+      index                 = (int)(oldest - slots.begin());
+      slot_of[oldest->tile] = -1;
+    }
+
+    Slot& slot = slots[index];
+    slot.tile  = tile;
+    slot.width = std::min(tile_size, grid.width - tx * tile_size);
+    decode_tile(data.data() + offsets[tile], slot.pixels.data(), slot.width, slot.width, std::min(tile_size, grid.height - ty * tile_size));
+    slot_of[tile] = index;
+  }
+
+  Slot& slot     = slots[index];
+  slot.last_used = ++clock;
+  return slot;
+}
+
+size_t TileStore::tile_count() const {
+  if (grids.empty()) return 0;
+  const Grid& last = grids.back();
+  return last.first + (size_t)last.tiles_x * ((last.height + tile_size - 1) / tile_size);
+}
+
+// The grid a tile belongs to and its column and row there.
+void TileStore::locate(size_t tile, const Grid*& grid, int& tx, int& ty) const {
+  auto next = std::upper_bound(grids.begin(), grids.end(), tile, [](size_t t, const Grid& g) { return t < g.first; });
+  grid      = &*(next - 1);
+  tx        = (int)((tile - grid->first) % grid->tiles_x);
+  ty        = (int)((tile - grid->first) / grid->tiles_x);
+}
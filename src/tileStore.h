@@ -0,0 +1,93 @@
+#ifndef _TILE_STORE_H_
+#define _TILE_STORE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct RGB;
+struct CaptureRegion;
+
+// The pixels of a capture compressed in tiles, for while only the textures
+// are drawn from and the pixels are merely looked up, e.g. by ColorState or
+// when saving. Tiles are compressed losslessly with a QOI style codec, which
+// shrinks screenshots to a fraction and decodes a tile in microseconds. The
+// tiles looked at last stay decompressed, so lookups near each other only
+// cost an index.
+class TileStore {
+public:
+  static constexpr int tile_size = 64;
+  // 768 KB decompressed, more than a panel of text needs
+  static constexpr size_t cached_tiles = 64;
+
+  TileStore();
+  ~TileStore();
+
+  TileStore(const TileStore&)            = delete;
+  TileStore& operator=(const TileStore&) = delete;
+
+  // Compresses pixels, laid out in regions as Capture::pixels is, on up to
+  // one thread per core.
+  void compress(const std::vector<CaptureRegion>& regions, const RGB* pixels);
+
+  // The same a few tiles at a time, for callers that can't wait for all of
+  // them. begin starts over, compress_next compresses the next count tiles
+  // and returns false once none are left.
+  void begin(const std::vector<CaptureRegion>& regions);
+  bool compress_next(const RGB* pixels, size_t count);
+
+  // Decompresses every tile back into pixels.
+  void decompress(RGB* pixels) const;
+
+  void clear();
+  void swap(TileStore& other);
+
+  bool empty() const {
+    return grids.empty();
+  }
+
+  // compressed bytes
+  size_t size() const {
+    return data.size();
+  }
+
+  // The pixel at x, y of region, relative to the region.
+  RGB at(size_t region, int x, int y) const;
+
+  // Copies the w x h rectangle at x, y of region into dst, whose rows are
+  // dst_stride pixels apart. Every tile it touches is decoded once, straight
+  // into dst when all of it is read, so reading in bands of tile_size rows
+  // decodes the region once. The cached tiles are used but left alone.
+  void read(size_t region, int x, int y, int w, int h, RGB* dst, int dst_stride) const;
+
+private:
+  struct Grid {
+    size_t first;  // index of the region's first tile
+    size_t offset; // of the region in Capture::pixels
+    int width;
+    int height;
+    int tiles_x;
+  };
+
+  struct Slot {
+    size_t tile;
+    int width; // pixels are this far apart
+    uint64_t last_used;
+    std::vector<RGB> pixels;
+  };
+
+  const Slot& cached(const Grid& grid, int tx, int ty) const;
+  void locate(size_t tile, const Grid*& grid, int& tx, int& ty) const;
+  size_t tile_count() const;
+
+  std::vector<Grid> grids;
+  std::vector<uint8_t> data;
+  std::vector<size_t> offsets; // where each tile starts in data, and the end
+
+  // the decompressed tiles, least recently used first to go
+  mutable std::vector<Slot> slots;
+  mutable std::vector<int> slot_of; // by tile, -1 when not decompressed
+  mutable uint64_t clock = 0;
+};
+
+#endif
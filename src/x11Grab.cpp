@@ -0,0 +1,372 @@
+#include "x11Grab.h"
+#include "convert.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <string>
+
+#include <X11/Xatom.h>
+#include <X11/Xutil.h>
+#include <X11/cursorfont.h>
+#include <X11/extensions/Xrandr.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+
+// set from the error handler on the thread whose XSync reported the error
+static thread_local bool xshm_attach_failed = false;
+
+int x11_error_handler(Display* display, XErrorEvent* event) {
+  xshm_attach_failed = true;
+  return 0;
+}
+
+bool x11_error_reset() {
+  bool failed        = xshm_attach_failed;
+  xshm_attach_failed = false;
+  return failed;
+}
+
+size_t xshm_size(Display* display, const XWindowAttributes& attr, const std::vector<CaptureRegion>& regions) {
+  if (!XShmQueryExtension(display)) return 0;
+
+  XShmSegmentInfo shminfo;
+  size_t size = 0;
+  for (const CaptureRegion& region : regions) {
+    XImage* image = XShmCreateImage(display, attr.visual, attr.depth, ZPixmap, nullptr, &shminfo, region.width, region.height);
+    if (!image) return 0;
+    size = std::max(size, (size_t)image->bytes_per_line * image->height);
+    XDestroyImage(image);
+  }
+  return size;
+}
+
+bool xshm_attach(Display* display, size_t size, XShmSegmentInfo& shminfo) {
+  shminfo.shmid = shmget(IPC_PRIVATE, size, IPC_CREAT | 0600);
+  if (shminfo.shmid < 0) return false;
+
+  shminfo.shmaddr = (char*)shmat(shminfo.shmid, nullptr, 0);
+  if (shminfo.shmaddr == (char*)-1) {
+    shmctl(shminfo.shmid, IPC_RMID, nullptr);
+    return false;
+  }
+  shminfo.readOnly = False;
+
+  // the error handler is process wide, callers install x11_error_handler
+  // around the whole grab so threads don't race on it.
+  xshm_attach_failed = false;
+  XShmAttach(display, &shminfo);
+  XSync(display, False);
+
+  // the segment is released once both sides detach, even if we crash
+  shmctl(shminfo.shmid, IPC_RMID, nullptr);
+
+  if (xshm_attach_failed) {
+    shmdt(shminfo.shmaddr);
+    return false;
+  }
+
+  return true;
+}
+
+bool xshm_attach(Display* display, const XWindowAttributes& attr, const std::vector<CaptureRegion>& regions, XShmSegmentInfo& shminfo) {
+  size_t size = xshm_size(display, attr, regions);
+  return size > 0 && xshm_attach(display, size, shminfo);
+}
+
+void xshm_detach(Display* display, XShmSegmentInfo& shminfo) {
+  XShmDetach(display, &shminfo);
+  shmdt(shminfo.shmaddr);
+}
+
+// Appends the parts of rect that no region covers yet, so every screen pixel
+// is grabbed once. Mirrored CRTCs are skipped entirely, partly overlapping
+// ones (rotated or panned mirrors) add at most four strips around the
+// overlap.
+static void add_uncovered(std::vector<CaptureRegion>& regions, const CaptureRegion& rect) {
+  std::vector<CaptureRegion> pieces = {rect};
+  for (const CaptureRegion& region : regions) {
+    std::vector<CaptureRegion> rest;
+    for (const CaptureRegion& p : pieces) {
+      int x1 = std::max(p.x, region.x);
+      int y1 = std::max(p.y, region.y);
+      int x2 = std::min(p.x + p.width, region.x + region.width);
+      int y2 = std::min(p.y + p.height, region.y + region.height);
+      if (x2 <= x1 || y2 <= y1) {
+        rest.push_back(p);
+        continue;
+      }
+
+      // above and below the overlap at full width, left and right of it
+      // only as tall as the overlap
+      if (y1 > p.y) rest.push_back({p.x, p.y, p.width, y1 - p.y, 0});
+      if (y2 < p.y + p.height) rest.push_back({p.x, y2, p.width, p.y + p.height - y2, 0});
+      if (x1 > p.x) rest.push_back({p.x, y1, x1 - p.x, y2 - y1, 0});
+      if (x2 < p.x + p.width) rest.push_back({x2, y1, p.x + p.width - x2, y2 - y1, 0});
+    }
+    pieces = std::move(rest);
+  }
+  regions.insert(regions.end(), pieces.begin(), pieces.end());
+}
+
+std::vector<CaptureRegion> xrandr_regions(Display* display, Window root, const XWindowAttributes& attr) {
+  std::vector<CaptureRegion> regions;
+
+  int event_base, error_base;
+  if (XRRQueryExtension(display, &event_base, &error_base)) {
+    XRRScreenResources* resources = XRRGetScreenResourcesCurrent(display, root);
+    if (resources) {
+      for (int i = 0; i < resources->ncrtc; i++) {
+        XRRCrtcInfo* crtc = XRRGetCrtcInfo(display, resources, resources->crtcs[i]);
+        if (!crtc) continue;
+
+        if (crtc->mode != None && crtc->noutput > 0) {
+          int x1 = std::max(crtc->x, 0);
+          int y1 = std::max(crtc->y, 0);
+          int x2 = std::min<int>(crtc->x + crtc->width, attr.width);
+          int y2 = std::min<int>(crtc->y + crtc->height, attr.height);
+
+          if (x2 > x1 && y2 > y1) {
+            add_uncovered(regions, {x1, y1, x2 - x1, y2 - y1, 0});
+          }
+        }
+
+        XRRFreeCrtcInfo(crtc);
+      }
+      XRRFreeScreenResources(resources);
+    }
+  }
+
+  if (regions.empty()) {
+    regions.push_back({0, 0, attr.width, attr.height, 0});
+  }
+
+  return regions;
+}
+
+// Where a channel sits in a pixel value, from a visual's channel mask.
+struct ChannelMask {
+  int shift = 0;
+  int bits  = 0;
+  unsigned long max = 0;
+
+  explicit ChannelMask(unsigned long mask) {
+    if (!mask) return;
+    while (!(mask & 1)) {
+      mask >>= 1;
+      shift++;
+    }
+    max  = mask;
+    bits = std::popcount(mask);
+  }
+
+  // The channel of pixel p scaled to 16 bits by repeating its bits, so the
+  // largest value becomes 0xFFFF.
+  uint16_t get16(unsigned long p) const {
+    if (!bits) return 0;
+    uint32_t value = (uint32_t)((p >> shift) & max);
+    uint32_t out   = 0;
+    int filled     = 0;
+    while (filled < 16) {
+      out = out << bits | value;
+      filled += bits;
+    }
+    return (uint16_t)(out >> (filled - 16));
+  }
+};
+
+int x11_channel_bits(const Visual* visual) {
+  return std::max({ChannelMask(visual->red_mask).bits, ChannelMask(visual->green_mask).bits, ChannelMask(visual->blue_mask).bits});
+}
+
+static void convert_ximage(XImage* image, RGB* dst, int dst_stride, int threads, RGB* dst_low) {
+  bool is_bgrx = image->bits_per_pixel == 32 && image->byte_order == LSBFirst &&
+                 image->red_mask == 0xFF0000 && image->green_mask == 0xFF00 && image->blue_mask == 0xFF;
+
+  if (is_bgrx) {
+    convert_to_rgb(PixelFormat::BGRX32, (const uint8_t*)image->data, image->bytes_per_line, dst, dst_stride, image->width, image->height, threads);
+    return;
+  }
+
+  // anything else, e.g. depth 30 visuals with 10 bits per channel, goes
+  // through the real masks. 32 bit pixels in host order are read directly,
+  // XGetPixel is slow.
+  ChannelMask red(image->red_mask), green(image->green_mask), blue(image->blue_mask);
+  bool direct = image->bits_per_pixel == 32 && image->byte_order == (std::endian::native == std::endian::little ? LSBFirst : MSBFirst);
+
+  for (int y = 0; y < image->height; y++) {
+    const uint32_t* row = (const uint32_t*)(image->data + (size_t)y * image->bytes_per_line);
+    for (int x = 0; x < image->width; x++) {
+      unsigned long p = direct ? row[x] : XGetPixel(image, x, y);
+      uint16_t r      = red.get16(p);
+      uint16_t g      = green.get16(p);
+      uint16_t b      = blue.get16(p);
+
+      dst[(size_t)y * dst_stride + x] = {(uint8_t)(r >> 8), (uint8_t)(g >> 8), (uint8_t)(b >> 8)};
+      if (dst_low) dst_low[(size_t)y * dst_stride + x] = {(uint8_t)r, (uint8_t)g, (uint8_t)b};
+    }
+  }
+}
+
+static XImage* get_image(Display* display, Drawable drawable, const XWindowAttributes& attr, XShmSegmentInfo* shminfo, int x, int y, int w, int h) {
+  if (!shminfo) return XGetImage(display, drawable, x, y, w, h, AllPlanes, ZPixmap);
+
+  XImage* image = XShmCreateImage(display, attr.visual, attr.depth, ZPixmap, shminfo->shmaddr, shminfo, w, h);
+  if (image && !XShmGetImage(display, drawable, image, x, y, AllPlanes)) {
+    XDestroyImage(image);
+    return nullptr;
+  }
+  return image;
+}
+
+bool grab_rect(Display* display, Drawable drawable, const XWindowAttributes& attr, XShmSegmentInfo* shminfo, int x, int y, int w, int h, RGB* dst, int dst_stride, int threads, RGB* dst_low) {
+  XImage* image = get_image(display, drawable, attr, shminfo, x, y, w, h);
+  if (!image) return false;
+
+  convert_ximage(image, dst, dst_stride, threads, dst_low);
+
+  XDestroyImage(image);
+  return true;
+}
+
+bool x11_is_bgrx(Display* display, const XWindowAttributes& attr) {
+  const Visual* visual = attr.visual;
+  if (ImageByteOrder(display) != LSBFirst || visual->red_mask != 0xFF0000 || visual->green_mask != 0xFF00 || visual->blue_mask != 0xFF) return false;
+
+  int count;
+  XPixmapFormatValues* formats = XListPixmapFormats(display, &count);
+  if (!formats) return false;
+
+  bool bgrx = false;
+  for (int i = 0; i < count; i++) {
+    if (formats[i].depth == attr.depth) bgrx = formats[i].bits_per_pixel == 32;
+  }
+  XFree(formats);
+  return bgrx;
+}
+
+bool grab_rect_bgrx(Display* display, Drawable drawable, const XWindowAttributes& attr, XShmSegmentInfo* shminfo, int x, int y, int w, int h, uint8_t* dst, size_t dst_pitch) {
+  XImage* image = get_image(display, drawable, attr, shminfo, x, y, w, h);
+  if (!image) return false;
+
+  for (int row = 0; row < h; row++) {
+    std::memcpy(dst + row * dst_pitch, image->data + (size_t)row * image->bytes_per_line, (size_t)w * 4);
+  }
+
+  XDestroyImage(image);
+  return true;
+}
+
+static bool has_wm_state(Display* display, Window window) {
+  Atom wm_state = XInternAtom(display, "WM_STATE", True);
+  if (wm_state == None) return false;
+
+  Atom type;
+  int format;
+  unsigned long count, after;
+  unsigned char* data = nullptr;
+  if (XGetWindowProperty(display, window, wm_state, 0, 0, False, AnyPropertyType, &type, &format, &count, &after, &data) != Success) {
+    return false;
+  }
+  if (data) XFree(data);
+  return type != None;
+}
+
+static Window find_client(Display* display, Window window) {
+  Window root, parent;
+  Window* children = nullptr;
+  unsigned int count;
+  if (!XQueryTree(display, window, &root, &parent, &children, &count)) return 0;
+
+  Window client = 0;
+  for (unsigned int i = 0; i < count && !client; i++) {
+    if (has_wm_state(display, children[i])) client = children[i];
+  }
+  for (unsigned int i = 0; i < count && !client; i++) {
+    client = find_client(display, children[i]);
+  }
+
+  if (children) XFree(children);
+  return client;
+}
+
+Window x11_client_window(Display* display, Window window) {
+  if (has_wm_state(display, window)) return window;
+
+  Window client = find_client(display, window);
+  return client ? client : window;
+}
+
+static std::string window_title(Display* display, Window window) {
+  Atom net_wm_name = XInternAtom(display, "_NET_WM_NAME", True);
+  Atom utf8_string = XInternAtom(display, "UTF8_STRING", True);
+
+  std::string title;
+  if (net_wm_name != None && utf8_string != None) {
+    Atom type;
+    int format;
+    unsigned long count, after;
+    unsigned char* data = nullptr;
+    if (XGetWindowProperty(display, window, net_wm_name, 0, 1024, False, utf8_string, &type, &format, &count, &after, &data) == Success && data) {
+      title.assign((const char*)data, count);
+      XFree(data);
+    }
+  }
+
+  if (title.empty()) {
+    char* name = nullptr;
+    if (XFetchName(display, window, &name) && name) {
+      title = name;
+      XFree(name);
+    }
+  }
+
+  return title;
+}
+
+static Window find_window_by_title(Display* display, Window window, const char* name) {
+  Window root, parent;
+  Window* children = nullptr;
+  unsigned int count;
+  if (!XQueryTree(display, window, &root, &parent, &children, &count)) return 0;
+
+  Window found = 0;
+  for (unsigned int i = 0; i < count && !found; i++) {
+    XWindowAttributes attr;
+    if (!XGetWindowAttributes(display, children[i], &attr) || attr.map_state != IsViewable) continue;
+
+    if (has_wm_state(display, children[i])) {
+      if (window_title(display, children[i]).find(name) != std::string::npos) found = children[i];
+    } else {
+      found = find_window_by_title(display, children[i], name);
+    }
+  }
+
+  if (children) XFree(children);
+  return found;
+}
+
+Window x11_find_window(Display* display, Window root, const char* name) {
+  return find_window_by_title(display, root, name);
+}
+
+Window x11_pick_window(Display* display, Window root) {
+  Cursor cursor = XCreateFontCursor(display, XC_crosshair);
+  if (XGrabPointer(display, root, False, ButtonPressMask, GrabModeSync, GrabModeAsync, root, cursor, CurrentTime) != GrabSuccess) {
+    XFreeCursor(display, cursor);
+    return 0;
+  }
+
+  XEvent event;
+  XAllowEvents(display, SyncPointer, CurrentTime);
+  XWindowEvent(display, root, ButtonPressMask, &event);
+
+  XUngrabPointer(display, CurrentTime);
+  XFreeCursor(display, cursor);
+  XSync(display, False);
+
+  // clicks on the desktop itself have no subwindow
+  if (event.xbutton.button != Button1 || event.xbutton.subwindow == None) return 0;
+
+  return x11_client_window(display, event.xbutton.subwindow);
+}
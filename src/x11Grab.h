@@ -0,0 +1,69 @@
+#ifndef _X11_GRAB_H_
+#define _X11_GRAB_H_
+
+#include <vector>
+
+#include <X11/Xlib.h>
+#include <X11/extensions/XShm.h>
+
+#include "capture.h"
+
+// Error handler that records failed XShm attaches for xshm_attach. It is
+// process wide, so install it around a whole grab rather than per thread.
+int x11_error_handler(Display* display, XErrorEvent* event);
+
+// Whether x11_error_handler saw an error on this thread since the last call.
+bool x11_error_reset();
+
+// Creates a shared memory segment big enough for the largest region and
+// attaches it to the X server, so grabbed pixels never travel over the X
+// connection. Returns false when the extension is missing or the server cannot
+// attach the segment (e.g. a remote display), in which case the caller should
+// fall back to XGetImage.
+bool xshm_attach(Display* display, const XWindowAttributes& attr, const std::vector<CaptureRegion>& regions, XShmSegmentInfo& shminfo);
+
+// Bytes a segment needs for the largest region, 0 without the extension.
+size_t xshm_size(Display* display, const XWindowAttributes& attr, const std::vector<CaptureRegion>& regions);
+
+// Attaches a segment of size bytes, e.g. one kept for several grabs.
+bool xshm_attach(Display* display, size_t size, XShmSegmentInfo& shminfo);
+void xshm_detach(Display* display, XShmSegmentInfo& shminfo);
+
+// Returns the rectangles of all active CRTCs, clipped to the root window.
+// They never overlap: mirrored outputs are reported once, partly overlapping
+// ones only with the part not covered yet. Falls back to the whole root
+// window when XRandR is unavailable.
+std::vector<CaptureRegion> xrandr_regions(Display* display, Window root, const XWindowAttributes& attr);
+
+// Grabs the w x h rectangle at x, y of drawable (the root window or a window
+// pixmap) and converts it into dst, through the attached shared memory segment
+// when shminfo is given. The rectangle must fit into the segment. threads
+// limits the conversion threads. Channels are scaled to 16 bits using the
+// visual's masks, dst gets the upper byte and dst_low, when given, the lower
+// byte (see Capture::low_bits).
+bool grab_rect(Display* display, Drawable drawable, const XWindowAttributes& attr, XShmSegmentInfo* shminfo, int x, int y, int w, int h, RGB* dst, int dst_stride, int threads, RGB* dst_low = nullptr);
+
+// Whether ZPixmaps of attr's visual are BGRX rows, the layout of nearly every
+// X server. grab_rect_bgrx only works for those.
+bool x11_is_bgrx(Display* display, const XWindowAttributes& attr);
+
+// Grabs like grab_rect, but copies the BGRX rows as they are into dst. The
+// rows are dst_pitch bytes apart.
+bool grab_rect_bgrx(Display* display, Drawable drawable, const XWindowAttributes& attr, XShmSegmentInfo* shminfo, int x, int y, int w, int h, uint8_t* dst, size_t dst_pitch);
+
+// Bits of the widest channel of visual, e.g. 10 for depth 30 visuals.
+int x11_channel_bits(const Visual* visual);
+
+// Returns the client window (the one the window manager put WM_STATE on) at or
+// below window, window manager frames are skipped this way. Falls back to
+// window itself.
+Window x11_client_window(Display* display, Window window);
+
+// Returns the first viewable client window whose title contains name, or 0.
+Window x11_find_window(Display* display, Window root, const char* name);
+
+// Turns the pointer into a crosshair until a window is clicked and returns its
+// client window. Any other button than the left one cancels and returns 0.
+Window x11_pick_window(Display* display, Window root);
+
+#endif
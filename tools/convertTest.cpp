@@ -0,0 +1,122 @@
+// Checks the SIMD pixel conversion kernels against the scalar ones. Every
+// format is converted at every level the CPU supports, on random widths
+// (including tails shorter than one SIMD block), odd and bottom-up pitches
+// and several thread counts. Exits with 1 on the first mismatch.
+//
+//   convert_test
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "capture.h"
+#include "convert.h"
+
+static const PixelFormat to_rgb_formats[] = {
+    PixelFormat::BGRX32,
+    PixelFormat::XRGB32,
+    PixelFormat::RGBA32,
+    PixelFormat::RGB24,
+    PixelFormat::BGR24,
+    PixelFormat::GRAY8,
+    PixelFormat::GRAYA8,
+};
+
+static const PixelFormat from_rgb_formats[] = {
+    PixelFormat::BGRX32,
+    PixelFormat::RGBA32,
+};
+
+static const char* level_name(ConvertLevel level) {
+  switch (level) {
+    case ConvertLevel::Scalar: return "scalar";
+    case ConvertLevel::SSSE3: return "ssse3";
+    case ConvertLevel::AVX2: return "avx2";
+  }
+  return "?";
+}
+
+struct Case {
+  int width;
+  int height;
+  int padding; // bytes after every source row
+  bool bottom_up;
+  int threads;
+};
+
+// Converts src, laid out as described by c, into RGB with the current level.
+static std::vector<RGB> to_rgb(PixelFormat format, const std::vector<uint8_t>& src, const Case& c) {
+  ptrdiff_t pitch      = (ptrdiff_t)c.width * pixel_format_bytes(format) + c.padding;
+  const uint8_t* first = src.data();
+  if (c.bottom_up) {
+    first += (c.height - 1) * pitch;
+    pitch = -pitch;
+  }
+
+  // a guard pixel after every row catches writes past width
+  int stride = c.width + 1;
+  std::vector<RGB> dst((size_t)stride * c.height, RGB{1, 2, 3});
+  convert_to_rgb(format, first, pitch, dst.data(), stride, c.width, c.height, c.threads);
+  return dst;
+}
+
+static std::vector<uint8_t> from_rgb(PixelFormat format, const std::vector<RGB>& src, const Case& c) {
+  ptrdiff_t pitch = (ptrdiff_t)c.width * 4 + c.padding;
+  std::vector<uint8_t> dst((size_t)pitch * c.height, 0x5a);
+  convert_from_rgb(format, src.data(), c.width, dst.data(), pitch, c.width, c.height, c.threads);
+  return dst;
+}
+
+int main() {
+  std::mt19937 random(1234);
+  std::vector<Case> cases;
+  for (int width = 1; width <= 80; width++) {
+    cases.push_back({width, 3, (int)(random() % 8), random() % 2 == 0, 1});
+  }
+  for (int i = 0; i < 40; i++) {
+    int width  = 1 + (int)(random() % 2000);
+    int height = 1 + (int)(random() % 300);
+    cases.push_back({width, height, (int)(random() % 8), random() % 2 == 0, 1 + (int)(random() % 8)});
+  }
+
+  size_t checked = 0;
+  for (const Case& c : cases) {
+    std::vector<uint8_t> src((size_t)c.height * (c.width * 4 + c.padding));
+    for (uint8_t& byte : src) byte = (uint8_t)random();
+    std::vector<RGB> rgb((size_t)c.width * c.height);
+    for (RGB& p : rgb) p = {(uint8_t)random(), (uint8_t)random(), (uint8_t)random()};
+
+    convert_set_level(ConvertLevel::Scalar);
+    std::vector<std::vector<RGB>> expected_rgb;
+    for (PixelFormat format : to_rgb_formats) expected_rgb.push_back(to_rgb(format, src, c));
+    std::vector<std::vector<uint8_t>> expected_4;
+    for (PixelFormat format : from_rgb_formats) expected_4.push_back(from_rgb(format, rgb, c));
+
+    for (ConvertLevel wanted : {ConvertLevel::Scalar, ConvertLevel::SSSE3, ConvertLevel::AVX2}) {
+      ConvertLevel level = convert_set_level(wanted);
+      if (level != wanted) continue;
+
+      for (size_t f = 0; f < std::size(to_rgb_formats); f++) {
+        std::vector<RGB> got = to_rgb(to_rgb_formats[f], src, c);
+        if (std::memcmp(got.data(), expected_rgb[f].data(), got.size() * sizeof(RGB)) != 0) {
+          std::fprintf(stderr, "convert_to_rgb format %zu differs at %s, %dx%d padding %d%s\n", f, level_name(level), c.width, c.height, c.padding, c.bottom_up ? " bottom up" : "");
+          return 1;
+        }
+        checked++;
+      }
+      for (size_t f = 0; f < std::size(from_rgb_formats); f++) {
+        std::vector<uint8_t> got = from_rgb(from_rgb_formats[f], rgb, c);
+        if (got != expected_4[f]) {
+          std::fprintf(stderr, "convert_from_rgb format %zu differs at %s, %dx%d padding %d\n", f, level_name(level), c.width, c.height, c.padding);
+          return 1;
+        }
+        checked++;
+      }
+    }
+  }
+
+  std::printf("%zu conversions match the scalar kernels\n", checked);
+  return 0;
+}
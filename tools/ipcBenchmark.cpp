@@ -0,0 +1,75 @@
+// Throughput benchmark for the socket API of cappy --daemon. Captures once,
+// then hammers each request type for a while and prints the rates:
+//
+//   cappy --daemon &
+//   ipc_benchmark [seconds per test]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <random>
+#include <vector>
+
+#include "cappyClient.h"
+
+using Clock = std::chrono::steady_clock;
+
+// Runs request until seconds passed, returns how many calls were made per
+// second, 0 when a call failed.
+static double rate(double seconds, const std::function<bool()>& request) {
+  size_t calls = 0;
+  auto start   = Clock::now();
+  auto end     = start + std::chrono::duration<double>(seconds);
+  while (Clock::now() < end) {
+    if (!request()) return 0.0;
+    calls++;
+  }
+  return calls / std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+int main(int argc, char** argv) {
+  double seconds = argc > 1 ? std::atof(argv[1]) : 2.0;
+
+  CappyClient client;
+  if (!client.connect()) {
+    std::fprintf(stderr, "No cappy daemon at '%s', start one with cappy --daemon\n", cappy_socket_path().c_str());
+    return 1;
+  }
+
+  CappyCaptureInfo info;
+  auto start = Clock::now();
+  if (!client.capture(&info)) {
+    std::fprintf(stderr, "Capture failed (status %u)\n", client.last_status());
+    return 1;
+  }
+  double capture_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+  std::printf("capture: %dx%d, %u regions, %.1f ms\n", info.width, info.height, info.region_count, capture_ms);
+
+  std::mt19937 random(1);
+  std::vector<CappyPoint> points(65536);
+  for (CappyPoint& p : points) {
+    p = {(int32_t)(random() % info.width), (int32_t)(random() % info.height)};
+  }
+  std::vector<CappyPixel> pixels(points.size());
+
+  for (size_t batch : {1, 64, 4096, 65536}) {
+    double r = rate(seconds, [&]() { return client.pixels(points.data(), batch, pixels.data()); });
+    std::printf("pixels x%-6zu %10.0f requests/s %12.0f pixels/s\n", batch, r, r * batch);
+  }
+
+  int side = std::min({256, info.width, info.height});
+  for (CappyRect rect : {CappyRect{0, 0, side, side}, CappyRect{0, 0, info.width, info.height}}) {
+    std::vector<uint8_t> rgb((size_t)rect.width * rect.height * 3);
+    double r = rate(seconds, [&]() { return client.region(rect, rgb.data()); });
+    std::printf("region %dx%d %10.0f requests/s %9.1f MB/s\n", rect.width, rect.height, r, r * rgb.size() / 1e6);
+  }
+
+  CappyStats stats;
+  CappyRect all = {0, 0, info.width, info.height};
+  double r      = rate(seconds, [&]() { return client.stats(all, stats); });
+  std::printf("stats %dx%d %11.1f requests/s\n", info.width, info.height, r);
+
+  return 0;
+}
@@ -0,0 +1,66 @@
+// Checks ScrollStitcher on a generated page that scrolls by a steady amount
+// through a section repeating every few rows, e.g. a list of equal entries,
+// where several shifts match a frame equally well. The stitched image has to
+// be the page row for row. Exits with 1 on the first mismatch.
+//
+//   scroll_stitch_test
+
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "capture.h"
+#include "scrollStitch.h"
+
+// A page of noise rows whose rows from repeat_start on repeat every period
+// rows until repeat_end.
+static std::vector<RGB> make_page(int width, int height, int repeat_start, int repeat_end, int period) {
+  std::vector<RGB> page((size_t)width * height);
+  for (int y = 0; y < height; y++) {
+    int source = y;
+    if (y >= repeat_start && y < repeat_end) source = repeat_start + (y - repeat_start) % period;
+
+    std::mt19937 random(source);
+    for (int x = 0; x < width; x++) {
+      page[(size_t)y * width + x] = {(uint8_t)random(), (uint8_t)random(), (uint8_t)random()};
+    }
+  }
+  return page;
+}
+
+int main() {
+  const int width  = 64;
+  const int height = 300;
+  const int rows   = 2500;
+  std::vector<RGB> page = make_page(width, rows, 600, 1800, 20);
+
+  for (int step : {50, 37, 7}) {
+    ScrollStitcher stitcher;
+    stitcher.reset(width, height);
+
+    int position = 0;
+    for (; position + height <= rows; position += step) {
+      int grew = stitcher.add(page.data() + (size_t)position * width);
+      if (position > 0 && grew != step) {
+        std::fprintf(stderr, "scrolling by %d, the frame at row %d grew the image by %d\n", step, position, grew);
+        return 1;
+      }
+    }
+
+    int expected = position - step + height;
+    if (stitcher.get_height() != expected) {
+      std::fprintf(stderr, "scrolling by %d, the image is %d rows instead of %d\n", step, stitcher.get_height(), expected);
+      return 1;
+    }
+    for (int y = 0; y < expected; y++) {
+      if (std::memcmp(stitcher.get_pixels().data() + (size_t)y * width, page.data() + (size_t)y * width, width * sizeof(RGB)) != 0) {
+        std::fprintf(stderr, "scrolling by %d, row %d differs from the page\n", step, y);
+        return 1;
+      }
+    }
+  }
+
+  std::printf("stitched pages match row for row\n");
+  return 0;
+}
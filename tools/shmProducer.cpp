@@ -0,0 +1,120 @@
+// Test producer for cappy's shared memory capture. Writes an animated test
+// pattern into a frame ring, view it with:
+//
+//   shm_producer /cappy-test 1280 720 60 &
+//   cappy --shm /cappy-test
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "shmFrames.h"
+
+static constexpr uint32_t slot_count = 3;
+
+static volatile std::sig_atomic_t quit = 0;
+
+static void on_signal(int) {
+  quit = 1;
+}
+
+// diagonal color bands that move one pixel per frame, with a white bar that
+// shows the frame number in binary along the top.
+static void draw_frame(uint8_t* dst, const ShmFramesHeader& header, uint64_t sequence) {
+  for (uint32_t y = 0; y < header.height; y++) {
+    uint8_t* row = dst + (size_t)y * header.pitch;
+    for (uint32_t x = 0; x < header.width; x++) {
+      uint8_t r = (uint8_t)(x + sequence);
+      uint8_t g = (uint8_t)(y + sequence * 2);
+      uint8_t b = (uint8_t)((x + y) / 2);
+
+      if (y < 16 && x / 16 < 64) {
+        bool bit = (sequence >> (63 - x / 16)) & 1;
+        r = g = b = bit ? 255 : 0;
+      }
+
+      if (header.format == SHM_FRAMES_BGRX32) {
+        row[x * 4 + 0] = b;
+        row[x * 4 + 1] = g;
+        row[x * 4 + 2] = r;
+        row[x * 4 + 3] = 255;
+      } else {
+        row[x * 3 + 0] = r;
+        row[x * 3 + 1] = g;
+        row[x * 3 + 2] = b;
+      }
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  std::string name = argc > 1 ? argv[1] : "/cappy-test";
+  uint32_t width   = argc > 2 ? std::atoi(argv[2]) : 1280;
+  uint32_t height  = argc > 3 ? std::atoi(argv[3]) : 720;
+  int fps          = argc > 4 ? std::atoi(argv[4]) : 60;
+  bool bgrx        = argc > 5 && std::strcmp(argv[5], "bgrx32") == 0;
+
+  if (width == 0 || height == 0 || fps <= 0) {
+    std::fprintf(stderr, "usage: %s [name] [width] [height] [fps] [rgb24|bgrx32]\n", argv[0]);
+    return 1;
+  }
+
+  ShmFramesHeader header = {};
+  header.magic           = shm_frames_magic;
+  header.version         = shm_frames_version;
+  header.width           = width;
+  header.height          = height;
+  header.format          = bgrx ? SHM_FRAMES_BGRX32 : SHM_FRAMES_RGB24;
+  header.pitch           = width * (bgrx ? 4 : 3);
+  header.slot_count      = slot_count;
+  header.header_size     = 4096;
+  header.slot_size       = ((uint64_t)header.pitch * height + 4095) & ~(uint64_t)4095;
+
+  size_t size = header.header_size + header.slot_size * slot_count;
+
+  shm_unlink(name.c_str());
+  int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0 || ftruncate(fd, size) != 0) {
+    std::perror("shm_open");
+    return 1;
+  }
+
+  uint8_t* base = (uint8_t*)mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) {
+    std::perror("mmap");
+    shm_unlink(name.c_str());
+    return 1;
+  }
+
+  std::memcpy(base, &header, sizeof(header));
+  ShmFramesHeader* shared = (ShmFramesHeader*)base;
+
+  std::signal(SIGINT, on_signal);
+  std::signal(SIGTERM, on_signal);
+
+  std::printf("writing %ux%u %s frames to '%s' at %d fps, ctrl+c to stop\n", width, height, bgrx ? "bgrx32" : "rgb24", name.c_str(), fps);
+
+  auto interval = std::chrono::microseconds(1000000 / fps);
+  auto next     = std::chrono::steady_clock::now();
+  for (uint64_t sequence = 1; !quit; sequence++) {
+    draw_frame(base + header.header_size + (sequence % slot_count) * header.slot_size, header, sequence);
+    std::atomic_ref<uint64_t>(shared->sequence).store(sequence, std::memory_order_release);
+
+    next += interval;
+    std::this_thread::sleep_until(next);
+  }
+
+  munmap(base, size);
+  shm_unlink(name.c_str());
+  return 0;
+}
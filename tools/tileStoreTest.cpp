@@ -0,0 +1,140 @@
+// Checks that TileStore gives back exactly what it compressed. Regions of odd
+// sizes are filled with noise, flat areas and runs of exactly 62 and 63
+// pixels (the longest run op and one more), compressed at once and a few
+// tiles at a time, and read back in full, pixel by pixel and in rectangles
+// straddling tiles, with and without decompressed tiles cached. Exits with 1
+// on the first mismatch.
+//
+//   tile_store_test
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "capture.h"
+#include "tileStore.h"
+
+// Fills the rows of region with a pattern chosen by the row: noise, flat
+// color, or runs of length 62 or 63 between single other pixels.
+static void fill(const CaptureRegion& region, RGB* pixels, std::mt19937& random) {
+  for (int y = 0; y < region.height; y++) {
+    RGB* row = pixels + region.offset + (size_t)y * region.width;
+    int run  = y % 4 == 2 ? 62 : 63;
+    for (int x = 0; x < region.width; x++) {
+      switch (y % 4) {
+        case 0: row[x] = {(uint8_t)random(), (uint8_t)random(), (uint8_t)random()}; break;
+        case 1: row[x] = {(uint8_t)(y / 8), 200, 17}; break;
+        default: row[x] = x % (run + 1) == 0 ? RGB{(uint8_t)x, 1, 2} : RGB{90, 90, (uint8_t)(y / 4)}; break;
+      }
+    }
+  }
+}
+
+static bool same(const RGB& a, const RGB& b) {
+  return a.r == b.r && a.g == b.g && a.b == b.b;
+}
+
+int main() {
+  // odd sizes, a single pixel, just under and over a tile, and a region of
+  // one flat color
+  std::vector<CaptureRegion> regions = {
+      {0, 0, 1, 1, 0},
+      {1, 0, 63, 65, 0},
+      {64, 0, 65, 129, 0},
+      {0, 200, 333, 97, 0},
+      {400, 0, 130, 191, 0},
+      {600, 0, 200, 150, 0},
+  };
+  size_t total = 0;
+  for (CaptureRegion& region : regions) {
+    region.offset = total;
+    total += (size_t)region.width * region.height;
+  }
+
+  std::mt19937 random(1234);
+  std::vector<RGB> pixels(total);
+  for (size_t i = 0; i + 1 < regions.size(); i++) fill(regions[i], pixels.data(), random);
+  const CaptureRegion& flat = regions.back();
+  std::fill(pixels.begin() + flat.offset, pixels.end(), RGB{12, 34, 56});
+
+  TileStore store;
+  store.compress(regions, pixels.data());
+
+  std::vector<RGB> out(total);
+  store.decompress(out.data());
+  if (std::memcmp(out.data(), pixels.data(), total * sizeof(RGB)) != 0) {
+    std::fprintf(stderr, "decompress differs from the compressed pixels\n");
+    return 1;
+  }
+
+  // compressing a few tiles at a time gives the same tiles
+  for (size_t count : {1, 3, 1000}) {
+    TileStore stepped;
+    stepped.begin(regions);
+    while (stepped.compress_next(pixels.data(), count)) {}
+    std::vector<RGB> stepped_out(total);
+    stepped.decompress(stepped_out.data());
+    if (stepped.size() != store.size() || std::memcmp(stepped_out.data(), pixels.data(), total * sizeof(RGB)) != 0) {
+      std::fprintf(stderr, "compress_next with %zu tiles at a time differs\n", count);
+      return 1;
+    }
+  }
+
+  size_t checked = 0;
+  for (size_t r = 0; r < regions.size(); r++) {
+    const CaptureRegion& region = regions[r];
+    for (int y = 0; y < region.height; y++) {
+      for (int x = 0; x < region.width; x++) {
+        if (!same(store.at(r, x, y), pixels[region.offset + (size_t)y * region.width + x])) {
+          std::fprintf(stderr, "at(%zu, %d, %d) differs\n", r, x, y);
+          return 1;
+        }
+        checked++;
+      }
+    }
+  }
+
+  // Rectangles around tile corners, so they take parts of up to four tiles,
+  // and random ones. Reads from store find tiles cached by at(), some right
+  // inside the rectangle, reads from cold never do. A guard pixel after every
+  // row catches writes past w.
+  TileStore cold;
+  cold.compress(regions, pixels.data());
+  for (int i = 0; i < 2000; i++) {
+    size_t r                    = random() % regions.size();
+    const CaptureRegion& region = regions[r];
+    int x, y;
+    if (i % 2 == 0) {
+      x = std::max(0, (int)(random() % (region.width / TileStore::tile_size + 1)) * TileStore::tile_size - (int)(random() % 5));
+      y = std::max(0, (int)(random() % (region.height / TileStore::tile_size + 1)) * TileStore::tile_size - (int)(random() % 5));
+      x = std::min(x, region.width - 1);
+      y = std::min(y, region.height - 1);
+    } else {
+      x = random() % region.width;
+      y = random() % region.height;
+    }
+    int w = 1 + random() % (region.width - x);
+    int h = 1 + random() % (region.height - y);
+
+    TileStore& source = i % 4 < 2 ? store : cold;
+    if (i % 4 == 1) source.at(r, x + random() % w, y + random() % h);
+
+    int stride = w + 1;
+    std::vector<RGB> dst((size_t)stride * h, RGB{1, 2, 3});
+    source.read(r, x, y, w, h, dst.data(), stride);
+    for (int row = 0; row < h; row++) {
+      const RGB* want = pixels.data() + region.offset + (size_t)(y + row) * region.width + x;
+      const RGB* got  = dst.data() + (size_t)row * stride;
+      if (std::memcmp(got, want, (size_t)w * sizeof(RGB)) != 0 || !same(got[w], RGB{1, 2, 3})) {
+        std::fprintf(stderr, "read(%zu, %d, %d, %d, %d) differs in row %d\n", r, x, y, w, h, row);
+        return 1;
+      }
+    }
+    checked++;
+  }
+
+  std::printf("%zu lookups and reads match the compressed pixels\n", checked);
+  return 0;
+}